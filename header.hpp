@@ -4,6 +4,14 @@
 #include "libraries/io.hpp"
 #include "libraries/io_file.hpp"
 #include "libraries/io_socket.hpp"
+#include "libraries/io_async.hpp"
+#include "libraries/io_log.hpp"
+#include "libraries/io_transfer.hpp"
+#include "libraries/io_event.hpp"
+#include "libraries/io_coroutine.hpp"
+#include "libraries/io_connect.hpp"
+#include "libraries/io_resolve.hpp"
+#include "libraries/io_linger.hpp"
 
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
@@ -2,8 +2,34 @@
 
 LIB_DEPENDENCIES
 
+namespace io::file { core::u8string createStrerror (int errnum, const char8_t *prefix = u8" (", const char8_t *suffix = u8")"); }
+
 namespace io {
 
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+size_t getSize (const iovec *v, size_t vSize) noexcept {
+  size_t s = 0;
+  for (const iovec *end = v + vSize; v != end; ++v) {
+    s += v->iov_len;
+  }
+  return s;
+}
+
+core::u8string Result::getMessage () const {
+  if (r >= 0) {
+    return core::u8string();
+  }
+  return core::u8string(operation) + io::file::createStrerror(getError());
+}
+
+size_t Result::check () const {
+  if (r < 0) {
+    throw core::PlainException(getMessage());
+  }
+  return static_cast<size_t>(r);
+}
+
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
 }
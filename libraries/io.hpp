@@ -7,9 +7,409 @@
 #define IO_ALREADYINCLUDED
 
 #include <core.hpp>
+#include <cerrno>
+#include <climits>
+#include <concepts>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 namespace io {
 
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+/**
+  Gets the total number of bytes described by the given sequence of
+  {@c iovec}s.
+*/
+size_t getSize (const iovec *v, size_t vSize) noexcept;
+
+/**
+  Writes all of the data described by the given sequence of {@c iovec}s by
+  calling the given {@c writev}-like function (which is given a sequence of
+  {@c iovec}s and returns the number of bytes that it wrote) as many times as
+  necessary. After a partial write, writing resumes from the exact element and
+  offset at which the previous call stopped.
+
+  @throw if the function writes nothing of a non-empty element (as it would
+  otherwise be called forever).
+*/
+template<typename _F> void writeAll (const iovec *v, size_t vSize, _F &&writev) {
+  std::vector<iovec> rest;
+  while (vSize != 0) {
+    const iovec *v0 = v;
+    size_t s = writev(v, vSize < IOV_MAX ? vSize : IOV_MAX);
+    for (; vSize != 0 && s >= v->iov_len; ++v, --vSize) {
+      s -= v->iov_len;
+    }
+    if (s == 0 && v == v0) {
+      throw core::PlainException(core::u8string(u8"failed to write (no data was accepted)"));
+    }
+    if (s != 0) {
+      DA(vSize != 0);
+      if (rest.empty()) {
+        rest.assign(v, v + vSize);
+        v = rest.data();
+      }
+      iovec &e = rest[static_cast<size_t>(v - rest.data())];
+      e.iov_base = static_cast<iu8f *>(e.iov_base) + s;
+      e.iov_len -= s;
+    }
+  }
+}
+
+/**
+  The outcome of one of the non-throwing ({@c try}) I/O operations, which
+  return failures rather than throwing them: either a number of bytes or an
+  {@c errno} value. Routine failures (such as {@c EAGAIN}, {@c ECONNRESET} or
+  {@c EPIPE}) thus cost no more than a successful call; a message is made
+  only if getMessage() or check() is called.
+*/
+class Result {
+  prv ssize_t r;
+  prv const char8_t *operation;
+
+  prv Result (ssize_t r, const char8_t *operation) noexcept : r(r), operation(operation) {
+  }
+
+  pub static Result ofSize (size_t s) noexcept {
+    return Result(static_cast<ssize_t>(s), nullptr);
+  }
+
+  /**
+    Creates a failed result for the given {@c errno} value and description of
+    what failed (e.g. "failed to read from file", which must be a literal or
+    otherwise outlive the Result).
+  */
+  pub static Result ofError (int errnum, const char8_t *operation) noexcept {
+    return Result(-errnum, operation);
+  }
+
+  pub bool succeeded () const noexcept {
+    return r >= 0;
+  }
+
+  /**
+    Gets the number of bytes (if the operation succeeded).
+  */
+  pub size_t getSize () const noexcept {
+    return static_cast<size_t>(r);
+  }
+
+  /**
+    Gets the {@c errno} value (if the operation failed) or zero.
+  */
+  pub int getError () const noexcept {
+    return r < 0 ? static_cast<int>(-r) : 0;
+  }
+
+  /**
+    Gets whether the operation failed only because it would have had to wait.
+  */
+  pub bool wouldBlock () const noexcept {
+    return r == -EAGAIN || r == -EWOULDBLOCK;
+  }
+
+  /**
+    Makes the message that the throwing form of the operation would have
+    thrown.
+  */
+  pub core::u8string getMessage () const;
+  /**
+    @return the number of bytes.
+    @throw the exception that the throwing form of the operation would have
+    thrown, if the operation failed.
+  */
+  pub size_t check () const;
+};
+
+/**
+  A source of bytes, whose {@c read()} reads up to the given number of bytes
+  into the given buffer, returning the number read or, at the end of the
+  stream, {@c numeric_limits<size_t>::max()} (and throwing on failure).
+*/
+template<typename _S> concept InputStream = requires (_S &stream, iu8f *b, size_t s) {
+  { stream.read(b, s) } -> std::same_as<size_t>;
+};
+
+/**
+  A sink for bytes, whose {@c write()} writes all of the given bytes (and
+  throws on failure).
+*/
+template<typename _S> concept OutputStream = requires (_S &stream, const iu8f *b, size_t s) {
+  stream.write(b, s);
+};
+
+// The adapters below each wrap a stream of type _S, which is held by
+// value if _S is an object type (i.e. the adapter was given an rvalue)
+// or by reference if it's a reference type (i.e. the adapter was given an
+// lvalue). They are resolved entirely at compile time, so any number of them
+// can be stacked without any indirect calls. A read result larger than the
+// size requested isn't a byte count (being the end of the stream or, for a
+// non-blocking stream, io::socket::SocketStream::wouldBlock), and is passed
+// back untouched.
+
+/**
+  An InputStream that reads from another through a buffer, so that many
+  small reads cost few reads of the underlying stream. Reads at least as
+  large as the buffer bypass it.
+*/
+template<typename _S> requires InputStream<std::remove_reference_t<_S>> class BufferedInputStream {
+  prv _S stream;
+  prv std::unique_ptr<iu8f[]> buffer;
+  prv size_t bufferSize;
+  prv size_t begin;
+  prv size_t end;
+
+  pub BufferedInputStream (_S &&stream, size_t bufferSize) : stream(std::forward<_S>(stream)), buffer(new iu8f[bufferSize]), bufferSize(bufferSize), begin(0), end(0) {
+    DPRE(bufferSize != 0);
+  }
+
+  pub std::remove_reference_t<_S> &getStream () noexcept {
+    return stream;
+  }
+
+  pub size_t read (iu8f *b, size_t s) {
+    if (s == 0) {
+      return 0;
+    }
+    if (begin == end) {
+      if (s >= bufferSize) {
+        return stream.read(b, s);
+      }
+      size_t r = stream.read(buffer.get(), bufferSize);
+      if (r > bufferSize) {
+        return r;
+      }
+      begin = 0;
+      end = r;
+    }
+
+    size_t outSize = end - begin < s ? end - begin : s;
+    std::memcpy(b, buffer.get() + begin, outSize);
+    begin += outSize;
+    return outSize;
+  }
+};
+
+template<typename _S> BufferedInputStream (_S &&, size_t) -> BufferedInputStream<_S>;
+
+/**
+  An OutputStream that writes to another through a buffer, so that many
+  small writes cost few writes to the underlying stream. Writes at least as
+  large as the buffer bypass it. Any data still buffered is lost if the
+  instance is destroyed without flush() having been called.
+*/
+template<typename _S> requires OutputStream<std::remove_reference_t<_S>> class BufferedOutputStream {
+  prv _S stream;
+  prv std::unique_ptr<iu8f[]> buffer;
+  prv size_t bufferSize;
+  prv size_t size;
+
+  pub BufferedOutputStream (_S &&stream, size_t bufferSize) : stream(std::forward<_S>(stream)), buffer(new iu8f[bufferSize]), bufferSize(bufferSize), size(0) {
+    DPRE(bufferSize != 0);
+  }
+
+  pub std::remove_reference_t<_S> &getStream () noexcept {
+    return stream;
+  }
+
+  pub void write (const iu8f *b, size_t s) {
+    if (s <= bufferSize - size) {
+      std::memcpy(buffer.get() + size, b, s);
+      size += s;
+      return;
+    }
+    flush();
+    if (s >= bufferSize) {
+      stream.write(b, s);
+      return;
+    }
+    std::memcpy(buffer.get(), b, s);
+    size = s;
+  }
+
+  /**
+    Writes any buffered data to the underlying stream (but doesn't flush
+    that).
+  */
+  pub void flush () {
+    if (size != 0) {
+      stream.write(buffer.get(), size);
+      size = 0;
+    }
+  }
+};
+
+template<typename _S> BufferedOutputStream (_S &&, size_t) -> BufferedOutputStream<_S>;
+
+/**
+  An InputStream that reads at most the given number of bytes from another
+  (e.g. the body of a length-prefixed message), ending there.
+*/
+template<typename _S> requires InputStream<std::remove_reference_t<_S>> class LimitedInputStream {
+  prv _S stream;
+  prv iu64 remaining;
+
+  pub LimitedInputStream (_S &&stream, iu64 limit) : stream(std::forward<_S>(stream)), remaining(limit) {
+  }
+
+  pub std::remove_reference_t<_S> &getStream () noexcept {
+    return stream;
+  }
+
+  /**
+    Gets the number of bytes that may yet be read.
+  */
+  pub iu64 getRemaining () const noexcept {
+    return remaining;
+  }
+
+  pub size_t read (iu8f *b, size_t s) {
+    if (s == 0) {
+      return 0;
+    }
+    if (remaining == 0) {
+      return std::numeric_limits<size_t>::max();
+    }
+    size_t chunkSize = remaining < s ? static_cast<size_t>(remaining) : s;
+    size_t r = stream.read(b, chunkSize);
+    if (r <= chunkSize) {
+      remaining -= r;
+    }
+    return r;
+  }
+};
+
+template<typename _S> LimitedInputStream (_S &&, iu64) -> LimitedInputStream<_S>;
+
+/**
+  A stream that passes reads and writes (whichever the underlying stream
+  supports) straight through, counting the bytes read and written.
+*/
+template<typename _S> class CountingStream {
+  prv _S stream;
+  prv iu64 readCount;
+  prv iu64 writtenCount;
+
+  pub explicit CountingStream (_S &&stream) : stream(std::forward<_S>(stream)), readCount(0), writtenCount(0) {
+  }
+
+  pub std::remove_reference_t<_S> &getStream () noexcept {
+    return stream;
+  }
+
+  pub iu64 getReadCount () const noexcept {
+    return readCount;
+  }
+
+  pub iu64 getWrittenCount () const noexcept {
+    return writtenCount;
+  }
+
+  pub size_t read (iu8f *b, size_t s) requires InputStream<std::remove_reference_t<_S>> {
+    size_t r = stream.read(b, s);
+    if (r <= s) {
+      readCount += r;
+    }
+    return r;
+  }
+
+  pub void write (const iu8f *b, size_t s) requires OutputStream<std::remove_reference_t<_S>> {
+    stream.write(b, s);
+    writtenCount += s;
+  }
+};
+
+template<typename _S> CountingStream (_S &&) -> CountingStream<_S>;
+
+/**
+  An InputStream that reads from another and also writes everything that it
+  reads to an OutputStream (e.g. to keep a copy of a request as it's parsed).
+*/
+template<typename _S, typename _O> requires InputStream<std::remove_reference_t<_S>> && OutputStream<std::remove_reference_t<_O>> class TeeInputStream {
+  prv _S stream;
+  prv _O copy;
+
+  pub TeeInputStream (_S &&stream, _O &&copy) : stream(std::forward<_S>(stream)), copy(std::forward<_O>(copy)) {
+  }
+
+  pub std::remove_reference_t<_S> &getStream () noexcept {
+    return stream;
+  }
+
+  pub std::remove_reference_t<_O> &getCopy () noexcept {
+    return copy;
+  }
+
+  pub size_t read (iu8f *b, size_t s) {
+    size_t r = stream.read(b, s);
+    if (r <= s) {
+      copy.write(b, r);
+    }
+    return r;
+  }
+};
+
+template<typename _S, typename _O> TeeInputStream (_S &&, _O &&) -> TeeInputStream<_S, _O>;
+
+/**
+  An OutputStream that writes everything to two others, in turn.
+*/
+template<typename _O0, typename _O1> requires OutputStream<std::remove_reference_t<_O0>> && OutputStream<std::remove_reference_t<_O1>> class TeeOutputStream {
+  prv _O0 stream0;
+  prv _O1 stream1;
+
+  pub TeeOutputStream (_O0 &&stream0, _O1 &&stream1) : stream0(std::forward<_O0>(stream0)), stream1(std::forward<_O1>(stream1)) {
+  }
+
+  pub std::remove_reference_t<_O0> &getStream0 () noexcept {
+    return stream0;
+  }
+
+  pub std::remove_reference_t<_O1> &getStream1 () noexcept {
+    return stream1;
+  }
+
+  pub void write (const iu8f *b, size_t s) {
+    stream0.write(b, s);
+    stream1.write(b, s);
+  }
+};
+
+template<typename _O0, typename _O1> TeeOutputStream (_O0 &&, _O1 &&) -> TeeOutputStream<_O0, _O1>;
+
+/**
+  An InputStream that reads from one stream until its end and then from
+  another (which can itself be a ConcatenatedInputStream, to join more).
+*/
+template<typename _S0, typename _S1> requires InputStream<std::remove_reference_t<_S0>> && InputStream<std::remove_reference_t<_S1>> class ConcatenatedInputStream {
+  prv _S0 stream0;
+  prv _S1 stream1;
+  prv bool onFirst;
+
+  pub ConcatenatedInputStream (_S0 &&stream0, _S1 &&stream1) : stream0(std::forward<_S0>(stream0)), stream1(std::forward<_S1>(stream1)), onFirst(true) {
+  }
+
+  pub size_t read (iu8f *b, size_t s) {
+    if (onFirst) {
+      size_t r = stream0.read(b, s);
+      if (r != std::numeric_limits<size_t>::max()) {
+        return r;
+      }
+      onFirst = false;
+    }
+    return stream1.read(b, s);
+  }
+};
+
+template<typename _S0, typename _S1> ConcatenatedInputStream (_S0 &&, _S1 &&) -> ConcatenatedInputStream<_S0, _S1>;
+
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
 }
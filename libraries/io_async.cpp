@@ -0,0 +1,560 @@
+#include "io_async.hpp"
+#include <atomic>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace io::file { core::u8string createStrerror (int errnum, const char8_t *prefix = u8" (", const char8_t *suffix = u8")"); }
+
+namespace io::async {
+
+using core::u8string;
+using core::PlainException;
+using std::move;
+using std::unique_ptr;
+using std::atomic_ref;
+using std::memory_order_acquire;
+using std::memory_order_release;
+using std::unique_lock;
+using std::lock_guard;
+using core::unsign;
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+DC();
+
+using io::file::createStrerror;
+
+int ioUringSetup (unsigned entries, io_uring_params *params) noexcept {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter (int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) noexcept {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+int ioUringRegister (int fd, unsigned opcode, const void *arg, unsigned argCount) noexcept {
+  return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, argCount));
+}
+
+template<typename _T> _T *offsetPtr (void *base, iu32 offset) noexcept {
+  return reinterpret_cast<_T *>(static_cast<char *>(base) + offset);
+}
+
+Ring::Ring (unsigned entries) : fd(-1), sqRing(nullptr), sqRingSize(0), cqRing(nullptr), cqRingSize(0), sqes(nullptr), sqLocalTail(0) {
+  memset(&params, 0, sizeof(params));
+  fd = ioUringSetup(entries, &params);
+  if (fd == -1) {
+    throw PlainException(u8string(u8"failed to set up an io_uring") + createStrerror(errno));
+  }
+
+  try {
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+      sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+    }
+
+    void *p = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (p == MAP_FAILED) {
+      throw PlainException(u8string(u8"failed to map an io_uring submission queue") + createStrerror(errno));
+    }
+    sqRing = p;
+    if (singleMmap) {
+      cqRing = sqRing;
+    } else {
+      p = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (p == MAP_FAILED) {
+        throw PlainException(u8string(u8"failed to map an io_uring completion queue") + createStrerror(errno));
+      }
+      cqRing = p;
+    }
+    p = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (p == MAP_FAILED) {
+      throw PlainException(u8string(u8"failed to map io_uring submission queue entries") + createStrerror(errno));
+    }
+    sqes = static_cast<io_uring_sqe *>(p);
+  } catch (...) {
+    destroy();
+    throw;
+  }
+
+  sqHead = offsetPtr<unsigned>(sqRing, params.sq_off.head);
+  sqTail = offsetPtr<unsigned>(sqRing, params.sq_off.tail);
+  sqArray = offsetPtr<unsigned>(sqRing, params.sq_off.array);
+  sqMask = *offsetPtr<unsigned>(sqRing, params.sq_off.ring_mask);
+  sqLocalTail = *sqTail;
+  cqHead = offsetPtr<unsigned>(cqRing, params.cq_off.head);
+  cqTail = offsetPtr<unsigned>(cqRing, params.cq_off.tail);
+  cqMask = *offsetPtr<unsigned>(cqRing, params.cq_off.ring_mask);
+  cqes = offsetPtr<io_uring_cqe>(cqRing, params.cq_off.cqes);
+  DW(, "set up io_uring with ", params.sq_entries, " SQ entries and ", params.cq_entries, " CQ entries");
+}
+
+Ring::~Ring () noexcept {
+  destroy();
+}
+
+void Ring::destroy () noexcept {
+  if (sqes) {
+    munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+    sqes = nullptr;
+  }
+  if (cqRing && cqRing != sqRing) {
+    munmap(cqRing, cqRingSize);
+  }
+  cqRing = nullptr;
+  if (sqRing) {
+    munmap(sqRing, sqRingSize);
+    sqRing = nullptr;
+  }
+  if (fd != -1) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+unsigned Ring::getFeatures () const noexcept {
+  return params.features;
+}
+
+unsigned Ring::getSqEntries () const noexcept {
+  return params.sq_entries;
+}
+
+unsigned Ring::getCqEntries () const noexcept {
+  return params.cq_entries;
+}
+
+io_uring_sqe *Ring::getSqe () noexcept {
+  unsigned head = atomic_ref<unsigned>(*sqHead).load(memory_order_acquire);
+  if (sqLocalTail - head >= params.sq_entries) {
+    return nullptr;
+  }
+
+  io_uring_sqe *sqe = &sqes[sqLocalTail & sqMask];
+  sqArray[sqLocalTail & sqMask] = sqLocalTail & sqMask;
+  ++sqLocalTail;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+unsigned Ring::getSqSpace () const noexcept {
+  return params.sq_entries - (sqLocalTail - atomic_ref<unsigned>(*sqHead).load(memory_order_acquire));
+}
+
+unsigned Ring::submit (unsigned minCompletions) {
+  atomic_ref<unsigned>(*sqTail).store(sqLocalTail, memory_order_release);
+  // Anything that the kernel has yet to consume (including any entries left
+  // over from an earlier partial submission) is passed.
+  unsigned toSubmit = sqLocalTail - atomic_ref<unsigned>(*sqHead).load(memory_order_acquire);
+  unsigned flags = minCompletions != 0 ? IORING_ENTER_GETEVENTS : 0;
+  if (toSubmit == 0 && flags == 0) {
+    return 0;
+  }
+
+  int r;
+  do {
+    r = ioUringEnter(fd, toSubmit, minCompletions, flags);
+  } while (r == -1 && errno == EINTR);
+  if (r == -1) {
+    throw PlainException(u8string(u8"failed to submit io_uring requests") + createStrerror(errno));
+  }
+  return unsign(r);
+}
+
+const io_uring_cqe *Ring::peekCqe () noexcept {
+  unsigned head = *cqHead;
+  if (head == atomic_ref<unsigned>(*cqTail).load(memory_order_acquire)) {
+    return nullptr;
+  }
+  return &cqes[head & cqMask];
+}
+
+void Ring::releaseCqe () noexcept {
+  atomic_ref<unsigned>(*cqHead).store(*cqHead + 1, memory_order_release);
+}
+
+void Ring::registerResources (unsigned opcode, const void *arg, unsigned argCount) {
+  int r = ioUringRegister(fd, opcode, arg, argCount);
+  if (r == -1) {
+    throw PlainException(u8string(u8"failed to register resources with an io_uring") + createStrerror(errno));
+  }
+}
+
+FileEngine::~FileEngine () {
+}
+
+unique_ptr<FileEngine> FileEngine::create (unsigned queueDepth, size_t threadCount) {
+  try {
+    return unique_ptr<FileEngine>(new UringFileEngine(queueDepth));
+  } catch (PlainException &) {
+    DW(, "io_uring is unavailable; falling back to a thread pool");
+  }
+  return unique_ptr<FileEngine>(new ThreadPoolFileEngine(threadCount));
+}
+
+UringFileEngine::UringFileEngine (unsigned queueDepth) : ring(queueDepth) {
+}
+
+void UringFileEngine::registerFiles (const int *fds, size_t fdsSize) {
+  try {
+    ring.registerResources(IORING_UNREGISTER_FILES, nullptr, 0);
+  } catch (PlainException &) {
+    // There were none registered.
+  }
+  if (fdsSize != 0) {
+    ring.registerResources(IORING_REGISTER_FILES, fds, static_cast<unsigned>(fdsSize));
+  }
+}
+
+void UringFileEngine::registerBuffers (const iovec *v, size_t vSize) {
+  try {
+    ring.registerResources(IORING_UNREGISTER_BUFFERS, nullptr, 0);
+  } catch (PlainException &) {
+    // There were none registered.
+  }
+  if (vSize != 0) {
+    ring.registerResources(IORING_REGISTER_BUFFERS, v, static_cast<unsigned>(vSize));
+  }
+}
+
+void UringFileEngine::queue (const Request &request) {
+  io_uring_sqe *sqe = ring.getSqe();
+  if (!sqe) {
+    ring.submit(0);
+    sqe = ring.getSqe();
+    if (!sqe) {
+      throw PlainException(u8string(u8"failed to queue an io_uring request (the submission queue is full)"));
+    }
+  }
+
+  if (request.bufferIndex != Request::noBuffer) {
+    sqe->opcode = request.write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->buf_index = static_cast<__u16>(request.bufferIndex);
+  } else {
+    sqe->opcode = request.write ? IORING_OP_WRITE : IORING_OP_READ;
+  }
+  sqe->fd = request.file;
+  if (request.registeredFile) {
+    sqe->flags |= IOSQE_FIXED_FILE;
+  }
+  sqe->off = request.offset;
+  sqe->addr = reinterpret_cast<__u64>(request.b);
+  sqe->len = request.s;
+  sqe->user_data = request.userData;
+}
+
+size_t UringFileEngine::submit () {
+  return ring.submit(0);
+}
+
+size_t UringFileEngine::poll (Completion *c, size_t cSize) {
+  size_t i = 0;
+  for (const io_uring_cqe *cqe; i != cSize && (cqe = ring.peekCqe()); ++i) {
+    c[i].userData = cqe->user_data;
+    c[i].result = cqe->res;
+    ring.releaseCqe();
+  }
+  return i;
+}
+
+size_t UringFileEngine::wait (Completion *c, size_t cSize, size_t minCSize) {
+  DPRE(minCSize <= cSize);
+  size_t i = poll(c, cSize);
+  while (i < minCSize) {
+    ring.submit(static_cast<unsigned>(minCSize - i));
+    i += poll(c + i, cSize - i);
+  }
+  return i;
+}
+
+ThreadPoolFileEngine::ThreadPoolFileEngine (size_t threadCount) : stopping(false) {
+  DPRE(threadCount != 0);
+  try {
+    for (size_t i = 0; i != threadCount; ++i) {
+      threads.emplace_back([this] () {
+        run();
+      });
+    }
+  } catch (...) {
+    {
+      lock_guard<std::mutex> l(lock);
+      stopping = true;
+    }
+    requestsAvailable.notify_all();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    throw;
+  }
+}
+
+ThreadPoolFileEngine::~ThreadPoolFileEngine () noexcept {
+  {
+    lock_guard<std::mutex> l(lock);
+    stopping = true;
+  }
+  requestsAvailable.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+}
+
+void ThreadPoolFileEngine::run () {
+  unique_lock<std::mutex> l(lock);
+  while (true) {
+    requestsAvailable.wait(l, [&] () {
+      return stopping || !requests.empty();
+    });
+    if (stopping) {
+      return;
+    }
+    Request request = requests.front();
+    requests.pop_front();
+    l.unlock();
+
+    ssize_t r;
+    do {
+      r = request.write ?
+        pwrite(request.file, request.b, request.s, static_cast<off_t>(request.offset)) :
+        pread(request.file, request.b, request.s, static_cast<off_t>(request.offset))
+      ;
+    } while (r == -1 && errno == EINTR);
+    if (r == -1) {
+      r = -errno;
+    }
+
+    l.lock();
+    completions.push_back(Completion{request.userData, r});
+    completionsAvailable.notify_one();
+  }
+}
+
+size_t ThreadPoolFileEngine::collect (Completion *c, size_t cSize) {
+  size_t i = 0;
+  for (; i != cSize && !completions.empty(); ++i) {
+    c[i] = completions.front();
+    completions.pop_front();
+  }
+  return i;
+}
+
+void ThreadPoolFileEngine::registerFiles (const int *fds, size_t fdsSize) {
+  files.assign(fds, fds + fdsSize);
+}
+
+void ThreadPoolFileEngine::registerBuffers (const iovec *, size_t) {
+}
+
+void ThreadPoolFileEngine::queue (const Request &request) {
+  queued.push_back(request);
+  if (request.registeredFile) {
+    DPRE(unsign(request.file) < files.size());
+    queued.back().file = files[unsign(request.file)];
+    queued.back().registeredFile = false;
+  }
+}
+
+size_t ThreadPoolFileEngine::submit () {
+  size_t s = queued.size();
+  if (s == 0) {
+    return 0;
+  }
+
+  {
+    lock_guard<std::mutex> l(lock);
+    requests.insert(requests.end(), queued.begin(), queued.end());
+  }
+  queued.clear();
+  if (s == 1) {
+    requestsAvailable.notify_one();
+  } else {
+    requestsAvailable.notify_all();
+  }
+  return s;
+}
+
+size_t ThreadPoolFileEngine::poll (Completion *c, size_t cSize) {
+  lock_guard<std::mutex> l(lock);
+  return collect(c, cSize);
+}
+
+size_t ThreadPoolFileEngine::wait (Completion *c, size_t cSize, size_t minCSize) {
+  DPRE(minCSize <= cSize);
+  unique_lock<std::mutex> l(lock);
+  completionsAvailable.wait(l, [&] () {
+    return completions.size() >= minCSize;
+  });
+  return collect(c, cSize);
+}
+
+// The kind of request is kept in the top byte of the kernel's user data.
+constexpr int KIND_SHIFT = 56;
+constexpr iu16 BUFFER_GROUP = 0;
+
+iu64 encodeUserData (UringSocketEngine::EventType type, iu64 userData) noexcept {
+  DPRE(userData >> KIND_SHIFT == 0);
+  return (static_cast<iu64>(type) << KIND_SHIFT) | userData;
+}
+
+UringSocketEngine::UringSocketEngine (unsigned queueDepth, size_t bufferSize, unsigned bufferCount) :
+  ring(queueDepth), bufferSize(bufferSize), bufferCount(bufferCount), buffers(new iu8f[bufferSize * bufferCount]), bufferRing(nullptr), bufferRingSize(0), bufferRingTail(0)
+{
+  DPRE(bufferCount != 0 && bufferCount <= 32768 && (bufferCount & (bufferCount - 1)) == 0);
+  DPRE(bufferSize != 0 && bufferSize <= 0xFFFFFFFF);
+
+  bufferRingSize = bufferCount * sizeof(io_uring_buf);
+  void *p = mmap(nullptr, bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (p == MAP_FAILED) {
+    throw PlainException(u8string(u8"failed to map an io_uring buffer ring") + createStrerror(errno));
+  }
+  bufferRing = static_cast<io_uring_buf_ring *>(p);
+
+  io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<__u64>(bufferRing);
+  reg.ring_entries = bufferCount;
+  reg.bgid = BUFFER_GROUP;
+  try {
+    ring.registerResources(IORING_REGISTER_PBUF_RING, &reg, 1);
+  } catch (...) {
+    munmap(bufferRing, bufferRingSize);
+    throw;
+  }
+
+  for (unsigned i = 0; i != bufferCount; ++i) {
+    releaseBuffer(static_cast<iu16>(i));
+  }
+}
+
+UringSocketEngine::~UringSocketEngine () noexcept {
+  io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.bgid = BUFFER_GROUP;
+  try {
+    ring.registerResources(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+  } catch (PlainException &) {
+    DW(, "failed to unregister io_uring buffer ring");
+  }
+  munmap(bufferRing, bufferRingSize);
+}
+
+io_uring_sqe *UringSocketEngine::getSqe () {
+  io_uring_sqe *sqe = ring.getSqe();
+  if (!sqe) {
+    ring.submit(0);
+    sqe = ring.getSqe();
+    if (!sqe) {
+      throw PlainException(u8string(u8"failed to queue an io_uring request (the submission queue is full)"));
+    }
+  }
+  return sqe;
+}
+
+void UringSocketEngine::accept (io::socket::PassiveTcpSocket &socket, iu64 userData) {
+  io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = socket.socket.getDescriptor();
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = encodeUserData(EventType::accepted, userData);
+}
+
+void UringSocketEngine::receive (io::socket::TcpSocketStream &stream, iu64 userData) {
+  io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = stream.getSocket().getDescriptor();
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->user_data = encodeUserData(EventType::received, userData);
+}
+
+void UringSocketEngine::send (io::socket::TcpSocketStream &stream, const iovec *v, size_t vSize, iu64 userData) {
+  DPRE(vSize != 0);
+  DPRE(vSize <= ring.getSqEntries());
+  // A chain is broken where a submission ends, so it must be queued whole.
+  if (ring.getSqSpace() < vSize) {
+    ring.submit(0);
+    if (ring.getSqSpace() < vSize) {
+      throw PlainException(u8string(u8"failed to queue an io_uring request (the submission queue is full)"));
+    }
+  }
+
+  int fd = stream.getSocket().getDescriptor();
+  iu64 encodedUserData = encodeUserData(EventType::sent, userData);
+  for (size_t i = 0; i != vSize; ++i) {
+    io_uring_sqe *sqe = ring.getSqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<__u64>(v[i].iov_base);
+    sqe->len = static_cast<__u32>(v[i].iov_len);
+    // (MSG_WAITALL makes the kernel retry short sends itself.)
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    if (i != vSize - 1) {
+      sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+    }
+    sqe->user_data = encodedUserData;
+  }
+}
+
+void UringSocketEngine::cancel (const io::socket::Socket &socket, iu64 userData) {
+  io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = socket.getDescriptor();
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->user_data = encodeUserData(EventType::cancelled, userData);
+}
+
+void UringSocketEngine::releaseBuffer (iu16 bufferId) noexcept {
+  DPRE(bufferId < bufferCount);
+  io_uring_buf &buf = bufferRing->bufs[bufferRingTail & (bufferCount - 1)];
+  buf.addr = reinterpret_cast<__u64>(buffers.get() + bufferId * bufferSize);
+  buf.len = static_cast<__u32>(bufferSize);
+  buf.bid = bufferId;
+  ++bufferRingTail;
+  atomic_ref<__u16>(bufferRing->tail).store(bufferRingTail, memory_order_release);
+}
+
+size_t UringSocketEngine::submit () {
+  return ring.submit(0);
+}
+
+size_t UringSocketEngine::poll (Event *e, size_t eSize) {
+  size_t i = 0;
+  for (const io_uring_cqe *cqe; i != eSize && (cqe = ring.peekCqe()); ++i) {
+    Event &event = e[i];
+    event.type = static_cast<EventType>(cqe->user_data >> KIND_SHIFT);
+    event.userData = cqe->user_data & ((static_cast<iu64>(1) << KIND_SHIFT) - 1);
+    event.result = cqe->res;
+    event.more = cqe->flags & IORING_CQE_F_MORE;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+      event.bufferId = static_cast<iu16>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+      event.b = buffers.get() + event.bufferId * bufferSize;
+    } else {
+      event.bufferId = 0;
+      event.b = nullptr;
+    }
+    ring.releaseCqe();
+  }
+  return i;
+}
+
+size_t UringSocketEngine::wait (Event *e, size_t eSize, size_t minESize) {
+  DPRE(minESize <= eSize);
+  size_t i = poll(e, eSize);
+  while (i < minESize) {
+    ring.submit(static_cast<unsigned>(minESize - i));
+    i += poll(e + i, eSize - i);
+  }
+  return i;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
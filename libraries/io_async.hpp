@@ -0,0 +1,387 @@
+/** @file */
+/* -----------------------------------------------------------------------------
+   Asynchronous I/O Library
+   © Geoff Crossland 2017-2022
+----------------------------------------------------------------------------- */
+#ifndef IO_ASYNC_ALREADYINCLUDED
+#define IO_ASYNC_ALREADYINCLUDED
+
+#include "io.hpp"
+#include "io_socket.hpp"
+#include <core.hpp>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <linux/io_uring.h>
+
+namespace io::async {
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+extern DC();
+
+/**
+  Manages an io_uring instance (a pair of submission and completion queues
+  shared with the kernel).
+*/
+class Ring {
+  prv int fd;
+  prv io_uring_params params;
+  prv void *sqRing;
+  prv size_t sqRingSize;
+  prv void *cqRing;
+  prv size_t cqRingSize;
+  prv io_uring_sqe *sqes;
+  prv unsigned *sqHead;
+  prv unsigned *sqTail;
+  prv unsigned *sqArray;
+  prv unsigned sqMask;
+  prv unsigned sqLocalTail;
+  prv unsigned *cqHead;
+  prv unsigned *cqTail;
+  prv unsigned cqMask;
+  prv io_uring_cqe *cqes;
+
+  /**
+    Creates an io_uring instance with (at least) the given number of
+    submission queue entries.
+
+    @throw if the system does not support io_uring.
+  */
+  pub explicit Ring (unsigned entries);
+  Ring (const Ring &) = delete;
+  Ring &operator= (const Ring &) = delete;
+  pub ~Ring () noexcept;
+
+  prv void destroy () noexcept;
+  /**
+    Gets the feature flags ({@c IORING_FEAT_*}) reported by the kernel.
+  */
+  pub unsigned getFeatures () const noexcept;
+  /**
+    Gets the number of submission queue entries.
+  */
+  pub unsigned getSqEntries () const noexcept;
+  /**
+    Gets the number of completion queue entries.
+  */
+  pub unsigned getCqEntries () const noexcept;
+  /**
+    Gets a cleared submission queue entry to be filled in, or nullptr if the
+    submission queue is full. The entry is not seen by the kernel until the
+    next submit().
+  */
+  pub io_uring_sqe *getSqe () noexcept;
+  /**
+    Gets the number of submission queue entries that getSqe() can currently
+    provide.
+  */
+  pub unsigned getSqSpace () const noexcept;
+  /**
+    Passes all filled-in submission queue entries to the kernel and, if the
+    given number is non-zero, waits until at least that many completions are
+    available.
+
+    @return the number of submission queue entries consumed by the kernel.
+  */
+  pub unsigned submit (unsigned minCompletions);
+  /**
+    Gets the oldest available completion queue entry, or nullptr if there are
+    none. Once it has been dealt with, it must be released with
+    releaseCqe().
+  */
+  pub const io_uring_cqe *peekCqe () noexcept;
+  pub void releaseCqe () noexcept;
+  /**
+    Performs an {@c io_uring_register} operation.
+  */
+  pub void registerResources (unsigned opcode, const void *arg, unsigned argCount);
+};
+
+/**
+  Describes an asynchronous read or write.
+*/
+struct Request {
+  static constexpr iu32 noBuffer = 0xFFFFFFFF;
+
+  /**
+    Whether the request is to write (rather than to read).
+  */
+  bool write;
+  /**
+    The file descriptor or, if {@c registeredFile} is true, the index of the
+    file in the sequence given to FileEngine::registerFiles().
+  */
+  int file;
+  bool registeredFile;
+  iu64 offset;
+  iu8f *b;
+  iu32 s;
+  /**
+    The index of the buffer (in the sequence given to
+    FileEngine::registerBuffers()) that wholly contains {@c b}, or
+    {@c noBuffer}.
+  */
+  iu32 bufferIndex;
+  /**
+    An arbitrary value, which is returned in the request's Completion.
+  */
+  iu64 userData;
+};
+
+/**
+  Describes the outcome of a Request.
+*/
+struct Completion {
+  iu64 userData;
+  /**
+    The number of bytes transferred (where zero, for a read, means the end of
+    the file) or the negation of an {@c errno} value. Note that, as for
+    {@c pread}/{@c pwrite}, fewer bytes than were requested may be transferred.
+  */
+  ssize_t result;
+};
+
+/**
+  Performs reads and writes on files asynchronously. Requests are queued
+  with queue(), handed to the system in batches by submit(), and their
+  Completions are collected (in no particular order) with poll() or wait().
+  An instance should be used by only one thread at a time.
+*/
+class FileEngine {
+  pub virtual ~FileEngine ();
+
+  /**
+    Creates an io_uring-backed engine with (at least) the given queue depth
+    or, if the system doesn't support io_uring, a ThreadPoolFileEngine with the
+    given number of threads.
+  */
+  pub static std::unique_ptr<FileEngine> create (unsigned queueDepth, size_t threadCount);
+
+  /**
+    Registers with the engine the given file descriptors (replacing any
+    previously-registered ones), so that requests can refer to them by index,
+    saving the system from having to look them up for each request.
+  */
+  pub virtual void registerFiles (const int *fds, size_t fdsSize) = 0;
+  /**
+    Registers with the engine the given buffers (replacing any
+    previously-registered ones), so that requests can refer to them by index,
+    saving the system from having to map them for each request.
+  */
+  pub virtual void registerBuffers (const iovec *v, size_t vSize) = 0;
+  /**
+    Queues the given request, which will be passed to the system by the next
+    submit() (or before, if the queue is full). The buffer must remain valid
+    until the request's Completion has been collected.
+  */
+  pub virtual void queue (const Request &request) = 0;
+  /**
+    Passes all queued requests to the system with a single call.
+
+    @return the number of requests passed.
+  */
+  pub virtual size_t submit () = 0;
+  /**
+    Collects up to the given number of available Completions, without waiting.
+
+    @return the number collected.
+  */
+  pub virtual size_t poll (Completion *c, size_t cSize) = 0;
+  /**
+    Collects up to the given number of Completions, first waiting until at
+    least the given minimum number are available (which must not be more than
+    the number of requests in flight).
+
+    @return the number collected.
+  */
+  pub virtual size_t wait (Completion *c, size_t cSize, size_t minCSize) = 0;
+};
+
+/**
+  A FileEngine that uses io_uring.
+*/
+class UringFileEngine : public FileEngine {
+  prv Ring ring;
+
+  /**
+    @throw if the system does not support io_uring.
+  */
+  pub explicit UringFileEngine (unsigned queueDepth);
+
+  pub void registerFiles (const int *fds, size_t fdsSize) override;
+  pub void registerBuffers (const iovec *v, size_t vSize) override;
+  pub void queue (const Request &request) override;
+  pub size_t submit () override;
+  pub size_t poll (Completion *c, size_t cSize) override;
+  pub size_t wait (Completion *c, size_t cSize, size_t minCSize) override;
+};
+
+/**
+  A FileEngine that performs blocking {@c pread}s and {@c pwrite}s on a pool of
+  threads (for systems without io_uring). Registered buffers are accepted, but
+  are of no benefit.
+*/
+class ThreadPoolFileEngine : public FileEngine {
+  prv std::vector<int> files;
+  prv std::vector<Request> queued;
+  prv std::mutex lock;
+  prv std::condition_variable requestsAvailable;
+  prv std::condition_variable completionsAvailable;
+  prv std::deque<Request> requests;
+  prv std::deque<Completion> completions;
+  prv bool stopping;
+  prv std::vector<std::thread> threads;
+
+  pub explicit ThreadPoolFileEngine (size_t threadCount);
+  ThreadPoolFileEngine (const ThreadPoolFileEngine &) = delete;
+  ThreadPoolFileEngine &operator= (const ThreadPoolFileEngine &) = delete;
+  pub ~ThreadPoolFileEngine () noexcept override;
+
+  prv void run ();
+  prv size_t collect (Completion *c, size_t cSize);
+  pub void registerFiles (const int *fds, size_t fdsSize) override;
+  pub void registerBuffers (const iovec *v, size_t vSize) override;
+  pub void queue (const Request &request) override;
+  pub size_t submit () override;
+  pub size_t poll (Completion *c, size_t cSize) override;
+  pub size_t wait (Completion *c, size_t cSize, size_t minCSize) override;
+};
+
+/**
+  Performs network I/O asynchronously with io_uring. A single request keeps
+  accepting connections on a passive socket (multishot accept), and a single
+  request keeps receiving data on a stream socket (multishot receive) into
+  buffers that the kernel picks from a ring of buffers provided by the engine.
+  A message made of several pieces is sent as a chain of linked sends, which
+  the kernel performs in order, producing a single completion. Requests are
+  handed to the system in batches by submit(), and Events are collected with
+  poll() or wait(). An instance should be used by only one thread at a time.
+*/
+class UringSocketEngine {
+  pub enum class EventType : iu8 {
+    /**
+      A connection was accepted ({@c result} is its file descriptor, which can
+      be taken on with {@c io::socket::TcpSocketStream(io::socket::Socket(fd))}).
+    */
+    accepted = 1,
+    /**
+      Data was received into a provided buffer ({@c b} and {@c bufferId}),
+      which must be given back with releaseBuffer() once it has been dealt
+      with, or ({@c result} is zero) the end of the stream was reached.
+    */
+    received,
+    /**
+      A message was sent completely ({@c result} is non-negative) or failed
+      (in which case there is an Event for each piece that failed or was
+      abandoned).
+    */
+    sent,
+    /**
+      A cancellation was made ({@c result} is the number of requests
+      cancelled, each of which ends with an Event of its own).
+    */
+    cancelled
+  };
+  /**
+    Describes the outcome of a request (or of one step of a multishot
+    request).
+  */
+  pub struct Event {
+    EventType type;
+    iu64 userData;
+    /**
+      A non-negative value (whose meaning depends on the type) or the
+      negation of an {@c errno} value.
+    */
+    int result;
+    /**
+      Whether a multishot request is still active (if not, it must be made
+      again to get further events; this happens, for example, when no
+      provided buffers are available).
+    */
+    bool more;
+    const iu8f *b;
+    iu16 bufferId;
+  };
+
+  prv Ring ring;
+  prv size_t bufferSize;
+  prv unsigned bufferCount;
+  prv std::unique_ptr<iu8f[]> buffers;
+  prv io_uring_buf_ring *bufferRing;
+  prv size_t bufferRingSize;
+  prv iu16 bufferRingTail;
+
+  /**
+    Creates an engine with (at least) the given queue depth, providing the
+    kernel with the given number (a power of two, up to 32768) of receive
+    buffers of the given size.
+
+    @throw if the system does not support io_uring (with provided buffer
+    rings).
+  */
+  pub UringSocketEngine (unsigned queueDepth, size_t bufferSize, unsigned bufferCount);
+  UringSocketEngine (const UringSocketEngine &) = delete;
+  UringSocketEngine &operator= (const UringSocketEngine &) = delete;
+  pub ~UringSocketEngine () noexcept;
+
+  prv io_uring_sqe *getSqe ();
+  /**
+    Starts accepting connections on the given passive socket, with an
+    {@c accepted} Event for each. The user data must fit in 56 bits.
+  */
+  pub void accept (io::socket::PassiveTcpSocket &socket, iu64 userData);
+  /**
+    Starts receiving data on the given stream, with a {@c received} Event for
+    each piece. The user data must fit in 56 bits.
+  */
+  pub void receive (io::socket::TcpSocketStream &stream, iu64 userData);
+  /**
+    Sends all of the data described by the given sequence of {@c iovec}s on
+    the given stream, with a single {@c sent} Event once it has all been sent.
+    The data must remain valid until then. The user data must fit in 56
+    bits.
+  */
+  pub void send (io::socket::TcpSocketStream &stream, const iovec *v, size_t vSize, iu64 userData);
+  /**
+    Cancels all requests on the given socket (such as multishot accepts and
+    receives), with a {@c cancelled} Event (with the given user data, which
+    must fit in 56 bits) for the cancellation itself.
+  */
+  pub void cancel (const io::socket::Socket &socket, iu64 userData);
+  /**
+    Makes the given buffer (from a {@c received} Event) available to the
+    kernel again.
+  */
+  pub void releaseBuffer (iu16 bufferId) noexcept;
+  /**
+    Passes all queued requests to the system with a single call.
+
+    @return the number of requests passed.
+  */
+  pub size_t submit ();
+  /**
+    Collects up to the given number of available Events, without waiting.
+
+    @return the number collected.
+  */
+  pub size_t poll (Event *e, size_t eSize);
+  /**
+    Collects up to the given number of Events, first passing all queued
+    requests to the system and waiting until at least the given minimum
+    number are available.
+
+    @return the number collected.
+  */
+  pub size_t wait (Event *e, size_t eSize, size_t minESize);
+};
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
+
+#endif
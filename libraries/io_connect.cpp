@@ -0,0 +1,226 @@
+#include "io_connect.hpp"
+#include <poll.h>
+
+namespace io::file { core::u8string createStrerror (int errnum, const char8_t *prefix = u8" (", const char8_t *suffix = u8")"); }
+
+namespace io::connect {
+
+using core::u8string;
+using core::PlainException;
+using std::move;
+using std::vector;
+using std::lock_guard;
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+using io::socket::Socket;
+using io::socket::TcpSocketAddress;
+using io::socket::TcpSocketStream;
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+DC();
+
+using io::file::createStrerror;
+
+vector<const TcpSocketAddress *> interleaveFamilies (const vector<TcpSocketAddress> &addrs) {
+  vector<const TcpSocketAddress *> first;
+  vector<const TcpSocketAddress *> second;
+  for (const TcpSocketAddress &addr : addrs) {
+    (addr.getFamily() == addrs.front().getFamily() ? first : second).push_back(&addr);
+  }
+
+  vector<const TcpSocketAddress *> ordered;
+  ordered.reserve(addrs.size());
+  for (size_t i = 0; i < first.size() || i < second.size(); ++i) {
+    if (i < first.size()) {
+      ordered.push_back(first[i]);
+    }
+    if (i < second.size()) {
+      ordered.push_back(second[i]);
+    }
+  }
+  return ordered;
+}
+
+TcpSocketStream finishConnect (Socket &&socket, bool keepalive) {
+  socket.setNonBlocking(false);
+  socket.setOptions(keepalive);
+  return TcpSocketStream(move(socket));
+}
+
+TcpSocketStream connect (const vector<TcpSocketAddress> &addrs, bool keepalive, const ConnectPolicy &policy) {
+  DPRE(!addrs.empty());
+  vector<const TcpSocketAddress *> ordered = interleaveFamilies(addrs);
+  vector<Socket> attempts;
+  vector<pollfd> pollFds;
+  size_t nextAddr = 0;
+  u8string lastFailure;
+
+  auto deadline = steady_clock::now() + policy.timeout;
+  auto nextStart = steady_clock::now();
+  while (true) {
+    auto now = steady_clock::now();
+    if (now >= deadline) {
+      break;
+    }
+    if (nextAddr != ordered.size() && now >= nextStart) {
+      const TcpSocketAddress &addr = *ordered[nextAddr++];
+      nextStart = now + policy.attemptDelay;
+      try {
+        Socket socket(addr);
+        socket.setNonBlocking(true);
+        if (socket.startConnect(addr)) {
+          return finishConnect(move(socket), keepalive);
+        }
+        pollFds.push_back(pollfd{socket.getDescriptor(), POLLOUT, 0});
+        attempts.push_back(move(socket));
+      } catch (PlainException &e) {
+        DW(, "connection attempt failed to start");
+        lastFailure = u8string(reinterpret_cast<const char8_t *>(e.what()));
+        // Move straight on to the next address.
+        nextStart = now;
+        continue;
+      }
+    }
+    if (attempts.empty()) {
+      if (nextAddr == ordered.size()) {
+        break;
+      }
+      continue;
+    }
+
+    auto until = nextAddr != ordered.size() && nextStart < deadline ? nextStart : deadline;
+    auto timeout = duration_cast<milliseconds>(until - now).count() + 1;
+    int r = poll(pollFds.data(), pollFds.size(), static_cast<int>(timeout));
+    if (r == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw PlainException(u8string(u8"failed to wait for network sockets to connect") + createStrerror(errno));
+    }
+
+    for (size_t i = 0; i != attempts.size();) {
+      if (pollFds[i].revents == 0) {
+        ++i;
+        continue;
+      }
+      int errnum = attempts[i].getError();
+      if (errnum == 0) {
+        return finishConnect(move(attempts[i]), keepalive);
+      }
+      DW(, "connection attempt failed");
+      lastFailure = u8string(u8"failed to connect a network socket") + createStrerror(errnum);
+      attempts.erase(attempts.begin() + static_cast<ptrdiff_t>(i));
+      pollFds.erase(pollFds.begin() + static_cast<ptrdiff_t>(i));
+      // Don't wait out the head start of an attempt that has failed.
+      nextStart = steady_clock::now();
+    }
+  }
+
+  if (!attempts.empty() || lastFailure.empty()) {
+    throw PlainException(u8string(u8"failed to connect a network socket (timed out)"));
+  }
+  throw PlainException(move(lastFailure));
+}
+
+ConnectionPool::ConnectionPool (const Policy &policy, const ConnectPolicy &connectPolicy, bool keepalive) : policy(policy), connectPolicy(connectPolicy), keepalive(keepalive), idleCount(0) {
+}
+
+bool ConnectionPool::isHealthy (TcpSocketStream &stream) {
+  // An idle connection should have nothing to read: the end of the stream
+  // means that the peer has closed it, and data or an error means that it's
+  // not in a reusable state.
+  iu8f b;
+  ssize_t r = ::recv(stream.getSocket().getDescriptor(), &b, 1, MSG_PEEK | MSG_DONTWAIT);
+  return r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+TcpSocketStream ConnectionPool::acquire (const u8string &key, const vector<TcpSocketAddress> &addrs) {
+  while (true) {
+    std::optional<TcpSocketStream> stream;
+    {
+      lock_guard<std::mutex> l(lock);
+      auto i = idle.find(key);
+      if (i == idle.end()) {
+        break;
+      }
+      Idle &candidate = i->second.back();
+      bool expired = steady_clock::now() - candidate.since > policy.maxIdleTime;
+      stream.emplace(move(candidate.stream));
+      i->second.pop_back();
+      if (i->second.empty()) {
+        idle.erase(i);
+      }
+      --idleCount;
+      if (expired) {
+        DW(, "discarding expired idle connection");
+        continue;
+      }
+    }
+
+    if (isHealthy(*stream)) {
+      return move(*stream);
+    }
+    DW(, "discarding unhealthy idle connection");
+  }
+
+  return connect(addrs, keepalive, connectPolicy);
+}
+
+void ConnectionPool::release (const u8string &key, TcpSocketStream &&stream) {
+  if (!isHealthy(stream)) {
+    DW(, "discarding unhealthy connection");
+    TcpSocketStream discarded(move(stream));
+    return;
+  }
+
+  // (Discarded connections are closed outside the lock.)
+  std::optional<TcpSocketStream> discarded;
+  lock_guard<std::mutex> l(lock);
+  if (idleCount >= policy.maxIdle) {
+    discarded.emplace(move(stream));
+    return;
+  }
+  std::deque<Idle> &keyIdle = idle[key];
+  if (keyIdle.size() >= policy.maxIdlePerKey) {
+    if (policy.maxIdlePerKey == 0) {
+      discarded.emplace(move(stream));
+      idle.erase(key);
+      return;
+    }
+    discarded.emplace(move(keyIdle.front().stream));
+    keyIdle.pop_front();
+    --idleCount;
+  }
+  keyIdle.push_back(Idle{move(stream), steady_clock::now()});
+  ++idleCount;
+}
+
+void ConnectionPool::prune () {
+  vector<TcpSocketStream> discarded;
+  lock_guard<std::mutex> l(lock);
+  auto now = steady_clock::now();
+  for (auto i = idle.begin(); i != idle.end();) {
+    std::deque<Idle> &keyIdle = i->second;
+    while (!keyIdle.empty() && now - keyIdle.front().since > policy.maxIdleTime) {
+      discarded.push_back(move(keyIdle.front().stream));
+      keyIdle.pop_front();
+      --idleCount;
+    }
+    if (keyIdle.empty()) {
+      i = idle.erase(i);
+    } else {
+      ++i;
+    }
+  }
+}
+
+size_t ConnectionPool::getIdleCount () {
+  lock_guard<std::mutex> l(lock);
+  return idleCount;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
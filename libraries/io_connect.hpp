@@ -0,0 +1,124 @@
+/** @file */
+/* -----------------------------------------------------------------------------
+   Connection I/O Library
+   © Geoff Crossland 2017-2022
+----------------------------------------------------------------------------- */
+#ifndef IO_CONNECT_ALREADYINCLUDED
+#define IO_CONNECT_ALREADYINCLUDED
+
+#include "io_socket.hpp"
+#include <core.hpp>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace io::connect {
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+extern DC();
+
+/**
+  Controls how connect() races its candidate addresses.
+*/
+struct ConnectPolicy {
+  /**
+    How long to wait for an attempt to succeed before starting the next one
+    alongside it (RFC 8305 recommends 250ms).
+  */
+  std::chrono::milliseconds attemptDelay;
+  /**
+    How long to wait, in all, for any attempt to succeed.
+  */
+  std::chrono::milliseconds timeout;
+};
+
+/**
+  Connects to whichever of the given addresses (such as those returned by
+  io::socket::TcpSocketAddress::get()) answers first, Happy Eyeballs-style
+  (RFC 8305): the addresses are tried in turn, alternating between address
+  families (starting with that of the first address), with each non-blocking
+  attempt given a head start before the next is started alongside it (or
+  straight away, if it fails). The first attempt to succeed is kept and the
+  rest are abandoned.
+
+  @return a (blocking) stream with the given keepalive setting.
+  @throw if no attempt succeeded before the timeout elapsed.
+*/
+io::socket::TcpSocketStream connect (const std::vector<io::socket::TcpSocketAddress> &addrs, bool keepalive, const ConnectPolicy &policy);
+
+/**
+  A pool of idle connections, keyed by caller-chosen names (e.g.
+  "host:port"), from which connections to the same backend can be reused
+  rather than set up afresh. A connection is checked before being handed out
+  and on being returned, and is discarded if the peer has closed it, sent
+  anything unexpected or reset it, or if it has been idle too long. All
+  methods may be called from any number of threads.
+*/
+class ConnectionPool {
+  /**
+    Limits on the pool's idle connections.
+  */
+  pub struct Policy {
+    /**
+      The most idle connections kept for each key (beyond which the oldest is
+      discarded).
+    */
+    size_t maxIdlePerKey;
+    /**
+      The most idle connections kept in all (beyond which returned
+      connections are discarded).
+    */
+    size_t maxIdle;
+    /**
+      How long a connection may sit idle before being discarded.
+    */
+    std::chrono::steady_clock::duration maxIdleTime;
+  };
+
+  prv struct Idle {
+    io::socket::TcpSocketStream stream;
+    std::chrono::steady_clock::time_point since;
+  };
+
+  prv Policy policy;
+  prv ConnectPolicy connectPolicy;
+  prv bool keepalive;
+  prv std::mutex lock;
+  prv std::map<core::u8string, std::deque<Idle>> idle;
+  prv size_t idleCount;
+
+  /**
+    Creates an empty pool with the given limits, which makes new connections
+    with connect() (with the given policy and keepalive setting).
+  */
+  pub ConnectionPool (const Policy &policy, const ConnectPolicy &connectPolicy, bool keepalive);
+  ConnectionPool (const ConnectionPool &) = delete;
+  ConnectionPool &operator= (const ConnectionPool &) = delete;
+
+  prv static bool isHealthy (io::socket::TcpSocketStream &stream);
+  /**
+    Hands out the most recently used healthy idle connection for the given
+    key or, if there isn't one, connects to the given addresses.
+  */
+  pub io::socket::TcpSocketStream acquire (const core::u8string &key, const std::vector<io::socket::TcpSocketAddress> &addrs);
+  /**
+    Returns the given connection (which must have no request or response
+    outstanding) to the pool under the given key, or discards it if it's
+    unhealthy or the pool is full.
+  */
+  pub void release (const core::u8string &key, io::socket::TcpSocketStream &&stream);
+  /**
+    Discards the connections that have been idle for too long.
+  */
+  pub void prune ();
+  pub size_t getIdleCount ();
+};
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
+
+#endif
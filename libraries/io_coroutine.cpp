@@ -0,0 +1,387 @@
+#include "io_coroutine.hpp"
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+namespace io::file { core::u8string createStrerror (int errnum, const char8_t *prefix = u8" (", const char8_t *suffix = u8")"); }
+
+namespace io::coroutine {
+
+using core::u8string;
+using core::PlainException;
+using std::move;
+using std::coroutine_handle;
+using std::unique_lock;
+using std::lock_guard;
+using std::vector;
+using io::event::Reactor;
+using io::socket::TcpSocketStream;
+using io::socket::PassiveTcpSocket;
+using io::file::FileStream;
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+DC();
+
+using io::file::createStrerror;
+
+/**
+  A coroutine that runs a spawned task to completion on behalf of a Loop,
+  destroying itself when done.
+*/
+class Detached {
+  pub class promise_type {
+    prv Loop &loop;
+    prv std::unordered_set<void *> &tasks;
+
+    pub promise_type (Loop &loop, std::unordered_set<void *> &tasks, std::exception_ptr &, Task<> &) noexcept : loop(loop), tasks(tasks) {
+    }
+
+    pub Detached get_return_object () noexcept {
+      return Detached(coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    pub std::suspend_always initial_suspend () const noexcept {
+      return std::suspend_always();
+    }
+
+    pub auto final_suspend () const noexcept {
+      struct Awaiter {
+        bool await_ready () const noexcept {
+          return false;
+        }
+
+        void await_suspend (coroutine_handle<promise_type> h) const noexcept {
+          promise_type &p = h.promise();
+          p.tasks.erase(h.address());
+          bool finished = p.tasks.empty();
+          Loop &loop = p.loop;
+          h.destroy();
+          if (finished) {
+            loop.post(nullptr);
+          }
+        }
+
+        void await_resume () const noexcept {
+        }
+      };
+      return Awaiter();
+    }
+
+    pub void return_void () const noexcept {
+    }
+
+    pub void unhandled_exception () const noexcept {
+      std::terminate();
+    }
+  };
+
+  pub coroutine_handle<promise_type> h;
+
+  pub explicit Detached (coroutine_handle<promise_type> h) noexcept : h(h) {
+  }
+};
+
+Detached drive (Loop &, std::unordered_set<void *> &, std::exception_ptr &r_failure, Task<> &task) {
+  Task<> t = move(task);
+  try {
+    co_await t;
+  } catch (...) {
+    DW(, "a spawned task failed");
+    if (!r_failure) {
+      r_failure = std::current_exception();
+    }
+  }
+}
+
+Loop::Loop (Reactor &reactor, size_t threadCount) : reactor(reactor), postFd(-1), stopping(false) {
+  postFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (postFd == -1) {
+    throw PlainException(u8string(u8"failed to create an eventfd") + createStrerror(errno));
+  }
+
+  try {
+    reactor.add(postFd, EPOLLIN, [this] (Reactor::Events) {
+      onPosted();
+    });
+    for (size_t i = 0; i != threadCount; ++i) {
+      threads.emplace_back([this] () {
+        runJobs();
+      });
+    }
+  } catch (...) {
+    stopThreads();
+    ::close(postFd);
+    throw;
+  }
+}
+
+Loop::~Loop () noexcept {
+  // The workers might yet post coroutines (that are about to be destroyed).
+  stopThreads();
+  try {
+    reactor.remove(postFd);
+  } catch (PlainException &) {
+    DW(, "failed to stop watching the post eventfd");
+  }
+  for (auto &i : waiters) {
+    try {
+      reactor.remove(i.first);
+    } catch (PlainException &) {
+      DW(, "failed to stop watching a file descriptor");
+    }
+  }
+  waiters.clear();
+  for (void *task : tasks) {
+    coroutine_handle<>::from_address(task).destroy();
+  }
+  tasks.clear();
+  ::close(postFd);
+}
+
+void Loop::stopThreads () noexcept {
+  {
+    lock_guard<std::mutex> l(lock);
+    stopping = true;
+  }
+  jobsAvailable.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+}
+
+void Loop::runJobs () {
+  unique_lock<std::mutex> l(lock);
+  while (true) {
+    jobsAvailable.wait(l, [&] () {
+      return stopping || !jobs.empty();
+    });
+    if (jobs.empty()) {
+      DA(stopping);
+      return;
+    }
+    std::function<void ()> job = move(jobs.front());
+    jobs.pop_front();
+    l.unlock();
+    job();
+    l.lock();
+  }
+}
+
+void Loop::onPosted () {
+  iu64 dummy;
+  while (::read(postFd, &dummy, sizeof(dummy)) == sizeof(dummy));
+
+  vector<coroutine_handle<>> ready;
+  {
+    lock_guard<std::mutex> l(lock);
+    swap(ready, posted);
+  }
+  for (coroutine_handle<> h : ready) {
+    if (h) {
+      h.resume();
+    } else if (tasks.empty()) {
+      // (A null handle is posted when the last spawned task finishes.)
+      reactor.stop();
+    }
+  }
+  if (failure) {
+    reactor.stop();
+  }
+}
+
+void Loop::onReady (int fd, Reactor::Events events) {
+  auto i = waiters.find(fd);
+  DA(i != waiters.end());
+  Waiters &w = i->second;
+  coroutine_handle<> reader;
+  coroutine_handle<> writer;
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+    std::swap(reader, w.reader);
+  }
+  if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+    std::swap(writer, w.writer);
+  }
+
+  // The descriptor is watched only while a coroutine is waiting on it (so
+  // that it can be closed freely at other times).
+  if (!w.reader && !w.writer) {
+    waiters.erase(i);
+    reactor.remove(fd);
+  } else if (reader || writer) {
+    reactor.modify(fd, w.reader ? EPOLLIN | EPOLLRDHUP : EPOLLOUT);
+  }
+
+  if (reader) {
+    reader.resume();
+  }
+  if (writer) {
+    writer.resume();
+  }
+  if (failure) {
+    reactor.stop();
+  }
+}
+
+void Loop::watch (int fd, bool write, coroutine_handle<> h) {
+  auto [i, added] = waiters.try_emplace(fd);
+  Waiters &w = i->second;
+  coroutine_handle<> &slot = write ? w.writer : w.reader;
+  DPRE(!slot);
+  slot = h;
+  Reactor::Events events = 0;
+  if (w.reader) {
+    events |= EPOLLIN | EPOLLRDHUP;
+  }
+  if (w.writer) {
+    events |= EPOLLOUT;
+  }
+  try {
+    if (added) {
+      reactor.add(fd, events, [this, fd] (Reactor::Events events) {
+        onReady(fd, events);
+      });
+    } else {
+      reactor.modify(fd, events);
+    }
+  } catch (...) {
+    slot = nullptr;
+    if (added) {
+      waiters.erase(i);
+    }
+    throw;
+  }
+}
+
+void Loop::spawn (Task<> &&task) {
+  Detached d = drive(*this, tasks, failure, task);
+  tasks.insert(d.h.address());
+  d.h.resume();
+}
+
+void Loop::run () {
+  if (!failure && !tasks.empty()) {
+    reactor.run();
+  }
+  if (failure) {
+    std::exception_ptr e = failure;
+    failure = nullptr;
+    std::rethrow_exception(e);
+  }
+}
+
+void Loop::post (coroutine_handle<> h) {
+  {
+    lock_guard<std::mutex> l(lock);
+    posted.push_back(h);
+  }
+  iu64 one = 1;
+  ssize_t r = ::write(postFd, &one, sizeof(one));
+  static_cast<void>(r);
+}
+
+Loop::ReadyAwaiter::ReadyAwaiter (Loop &loop, int fd, bool write) noexcept : loop(loop), fd(fd), write(write) {
+}
+
+bool Loop::ReadyAwaiter::await_ready () const noexcept {
+  return false;
+}
+
+void Loop::ReadyAwaiter::await_suspend (coroutine_handle<> h) {
+  loop.watch(fd, write, h);
+}
+
+void Loop::ReadyAwaiter::await_resume () const noexcept {
+}
+
+Loop::ReadyAwaiter Loop::readable (int fd) noexcept {
+  return ReadyAwaiter(*this, fd, false);
+}
+
+Loop::ReadyAwaiter Loop::writable (int fd) noexcept {
+  return ReadyAwaiter(*this, fd, true);
+}
+
+Loop::OffloadAwaiter::OffloadAwaiter (Loop &loop, std::function<void ()> &&function) noexcept : loop(loop), function(move(function)) {
+}
+
+bool Loop::OffloadAwaiter::await_ready () const noexcept {
+  return false;
+}
+
+void Loop::OffloadAwaiter::await_suspend (coroutine_handle<> h) {
+  DPRE(!loop.threads.empty());
+  {
+    lock_guard<std::mutex> l(loop.lock);
+    loop.jobs.push_back([this, h] () {
+      try {
+        function();
+      } catch (...) {
+        failure = std::current_exception();
+      }
+      loop.post(h);
+    });
+  }
+  loop.jobsAvailable.notify_one();
+}
+
+void Loop::OffloadAwaiter::await_resume () const {
+  if (failure) {
+    std::rethrow_exception(failure);
+  }
+}
+
+Loop::OffloadAwaiter Loop::offload (std::function<void ()> function) {
+  return OffloadAwaiter(*this, move(function));
+}
+
+Task<size_t> read (Loop &loop, TcpSocketStream &stream, iu8f *b, size_t s) {
+  while (true) {
+    size_t r = stream.read(b, s);
+    if (r != TcpSocketStream::wouldBlock) {
+      co_return r;
+    }
+    co_await loop.readable(stream.getSocket().getDescriptor());
+  }
+}
+
+Task<> write (Loop &loop, TcpSocketStream &stream, const iu8f *b, size_t s) {
+  while (s != 0) {
+    size_t r = stream.writeSome(b, s);
+    if (r == 0) {
+      co_await loop.writable(stream.getSocket().getDescriptor());
+      continue;
+    }
+    b += r;
+    s -= r;
+  }
+}
+
+Task<TcpSocketStream> accept (Loop &loop, PassiveTcpSocket &socket, bool keepalive) {
+  while (true) {
+    std::optional<TcpSocketStream> stream = socket.tryAccept(keepalive);
+    if (stream) {
+      stream->getSocket().setNonBlocking(true);
+      co_return move(*stream);
+    }
+    co_await loop.readable(socket.socket.getDescriptor());
+  }
+}
+
+Task<size_t> read (Loop &loop, FileStream &file, iu8f *b, size_t s) {
+  size_t r;
+  co_await loop.offload([&] () {
+    r = file.read(b, s);
+  });
+  co_return r;
+}
+
+Task<> write (Loop &loop, FileStream &file, const iu8f *b, size_t s) {
+  co_await loop.offload([&] () {
+    file.write(b, s);
+  });
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
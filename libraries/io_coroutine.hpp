@@ -0,0 +1,289 @@
+/** @file */
+/* -----------------------------------------------------------------------------
+   Coroutine I/O Library
+   © Geoff Crossland 2017-2022
+----------------------------------------------------------------------------- */
+#ifndef IO_COROUTINE_ALREADYINCLUDED
+#define IO_COROUTINE_ALREADYINCLUDED
+
+#include "io_event.hpp"
+#include "io_file.hpp"
+#include "io_socket.hpp"
+#include <core.hpp>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace io::coroutine {
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+extern DC();
+
+class PromiseBase {
+  prv std::coroutine_handle<> continuation;
+  prv std::exception_ptr failure;
+
+  prv class FinalAwaiter {
+    pub bool await_ready () const noexcept {
+      return false;
+    }
+
+    pub template<typename _P> std::coroutine_handle<> await_suspend (std::coroutine_handle<_P> h) noexcept {
+      std::coroutine_handle<> continuation = h.promise().continuation;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+
+    pub void await_resume () const noexcept {
+    }
+  };
+
+  pub std::suspend_always initial_suspend () const noexcept {
+    return std::suspend_always();
+  }
+
+  pub FinalAwaiter final_suspend () const noexcept {
+    return FinalAwaiter();
+  }
+
+  pub void unhandled_exception () noexcept {
+    failure = std::current_exception();
+  }
+
+  pub void setContinuation (std::coroutine_handle<> continuation) noexcept {
+    this->continuation = continuation;
+  }
+
+  prot void rethrowFailure () const {
+    if (failure) {
+      std::rethrow_exception(failure);
+    }
+  }
+};
+
+template<typename _T> class Promise : public PromiseBase {
+  prv std::optional<_T> value;
+
+  pub template<typename _U> void return_value (_U &&u) {
+    value.emplace(std::forward<_U>(u));
+  }
+
+  pub _T takeValue () {
+    rethrowFailure();
+    DA(value);
+    return std::move(*value);
+  }
+};
+
+template<> class Promise<void> : public PromiseBase {
+  pub void return_void () const noexcept {
+  }
+
+  pub void takeValue () const {
+    rethrowFailure();
+  }
+};
+
+/**
+  A coroutine that produces a value of the given type. A Task doesn't start
+  running until it is {@c co_await}ed (by another coroutine, which is then
+  resumed once the Task has finished, receiving its value or exception) or
+  handed to Loop::spawn().
+*/
+template<typename _T = void> class Task {
+  pub class promise_type : public Promise<_T> {
+    pub Task get_return_object () noexcept {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+  };
+
+  prv std::coroutine_handle<promise_type> h;
+
+  prv explicit Task (std::coroutine_handle<promise_type> h) noexcept : h(h) {
+  }
+
+  Task (const Task &) = delete;
+  Task &operator= (const Task &) = delete;
+
+  pub Task (Task &&o) noexcept : h(o.h) {
+    o.h = nullptr;
+  }
+
+  pub Task &operator= (Task &&o) noexcept {
+    if (this != &o) {
+      if (h) {
+        h.destroy();
+      }
+      h = o.h;
+      o.h = nullptr;
+    }
+    return *this;
+  }
+
+  pub ~Task () noexcept {
+    if (h) {
+      h.destroy();
+    }
+  }
+
+  pub bool await_ready () const noexcept {
+    return false;
+  }
+
+  pub std::coroutine_handle<> await_suspend (std::coroutine_handle<> awaiter) noexcept {
+    h.promise().setContinuation(awaiter);
+    return h;
+  }
+
+  pub _T await_resume () {
+    return h.promise().takeValue();
+  }
+};
+
+/**
+  Runs coroutines on an io::event::Reactor. A coroutine waits for a file
+  descriptor to become ready by {@c co_await}ing readable() or writable()
+  (whereupon the descriptor is watched by the reactor until it is ready), and
+  has blocking work (such as file I/O, which {@c epoll} can't wait for) done
+  on one of the loop's worker threads by {@c co_await}ing offload(), being
+  resumed on the loop's thread afterwards. A Loop should be used only by the
+  thread running its reactor (except for post()).
+*/
+class Loop {
+  prv struct Waiters {
+    std::coroutine_handle<> reader;
+    std::coroutine_handle<> writer;
+  };
+
+  prv io::event::Reactor &reactor;
+  prv std::unordered_map<int, Waiters> waiters;
+  prv std::unordered_set<void *> tasks;
+  prv std::exception_ptr failure;
+  prv int postFd;
+  prv std::mutex lock;
+  prv std::vector<std::coroutine_handle<>> posted;
+  prv std::condition_variable jobsAvailable;
+  prv std::deque<std::function<void ()>> jobs;
+  prv bool stopping;
+  prv std::vector<std::thread> threads;
+
+  /**
+    Creates a loop that runs on the given reactor, with the given number of
+    worker threads for offload().
+  */
+  pub Loop (io::event::Reactor &reactor, size_t threadCount);
+  Loop (const Loop &) = delete;
+  Loop &operator= (const Loop &) = delete;
+  /**
+    Destroys any coroutines that are still waiting.
+  */
+  pub ~Loop () noexcept;
+
+  prv void stopThreads () noexcept;
+  prv void runJobs ();
+  prv void onPosted ();
+  prv void onReady (int fd, io::event::Reactor::Events events);
+  prv void watch (int fd, bool write, std::coroutine_handle<> h);
+  /**
+    Starts running the given task, which the loop takes ownership of.
+  */
+  pub void spawn (Task<> &&task);
+  /**
+    Runs the reactor until every spawned task has finished (or the reactor is
+    stopped).
+
+    @throw the exception that escaped from a spawned task, if any did (in which
+    case the reactor is stopped at that point).
+  */
+  pub void run ();
+  /**
+    Arranges for the given coroutine to be resumed on the loop's thread. May
+    be called from any thread.
+  */
+  pub void post (std::coroutine_handle<> h);
+
+  pub class ReadyAwaiter {
+    prv Loop &loop;
+    prv int fd;
+    prv bool write;
+
+    pub ReadyAwaiter (Loop &loop, int fd, bool write) noexcept;
+
+    pub bool await_ready () const noexcept;
+    pub void await_suspend (std::coroutine_handle<> h);
+    pub void await_resume () const noexcept;
+  };
+
+  /**
+    Returns an awaitable that resumes the awaiting coroutine once the given
+    file descriptor is ready for reading (or has an error or has hung up). At
+    most one coroutine may be waiting to read each file descriptor.
+  */
+  pub ReadyAwaiter readable (int fd) noexcept;
+  /**
+    Returns an awaitable that resumes the awaiting coroutine once the given
+    file descriptor is ready for writing (or has an error or has hung up). At
+    most one coroutine may be waiting to write each file descriptor.
+  */
+  pub ReadyAwaiter writable (int fd) noexcept;
+
+  pub class OffloadAwaiter {
+    prv Loop &loop;
+    prv std::function<void ()> function;
+    prv std::exception_ptr failure;
+
+    pub OffloadAwaiter (Loop &loop, std::function<void ()> &&function) noexcept;
+
+    pub bool await_ready () const noexcept;
+    pub void await_suspend (std::coroutine_handle<> h);
+    pub void await_resume () const;
+  };
+
+  /**
+    Returns an awaitable that calls the given function on one of the loop's
+    worker threads and then resumes the awaiting coroutine (rethrowing any
+    exception that escaped from the function).
+  */
+  pub OffloadAwaiter offload (std::function<void ()> function);
+};
+
+/**
+  Reads from the given stream (which must be in non-blocking mode) as for
+  TcpSocketStream::read(), waiting for data to become available.
+*/
+Task<size_t> read (Loop &loop, io::socket::TcpSocketStream &stream, iu8f *b, size_t s);
+/**
+  Writes all of the given data to the given stream (which must be in
+  non-blocking mode), waiting whenever the socket's send buffer is full.
+*/
+Task<> write (Loop &loop, io::socket::TcpSocketStream &stream, const iu8f *b, size_t s);
+/**
+  Waits for a connection to the given passive socket (which must be in
+  non-blocking mode) and returns a TcpSocketStream (in non-blocking mode) for
+  it.
+*/
+Task<io::socket::TcpSocketStream> accept (Loop &loop, io::socket::PassiveTcpSocket &socket, bool keepalive);
+/**
+  Reads from the given file (as for FileStream::read()) on one of the loop's
+  worker threads.
+*/
+Task<size_t> read (Loop &loop, io::file::FileStream &file, iu8f *b, size_t s);
+/**
+  Writes to the given file (as for FileStream::write()) on one of the loop's
+  worker threads.
+*/
+Task<> write (Loop &loop, io::file::FileStream &file, const iu8f *b, size_t s);
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include "io_event.hpp"
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+namespace io::file { core::u8string createStrerror (int errnum, const char8_t *prefix = u8" (", const char8_t *suffix = u8")"); }
+
+namespace io::event {
+
+using core::u8string;
+using core::PlainException;
+using std::move;
+using std::shared_ptr;
+using core::unsign;
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+DC();
+
+using io::file::createStrerror;
+
+iu64 makeKey (int fd, iu32 generation) noexcept {
+  return (static_cast<iu64>(generation) << 32) | unsign(fd);
+}
+
+Reactor::Reactor () : epollFd(-1), wakeFd(-1), nextGeneration(1), stopping(false) {
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd == -1) {
+    throw PlainException(u8string(u8"failed to create an epoll instance") + createStrerror(errno));
+  }
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeFd == -1) {
+    int errnum = errno;
+    ::close(epollFd);
+    throw PlainException(u8string(u8"failed to create an eventfd") + createStrerror(errnum));
+  }
+
+  epoll_event e;
+  e.events = EPOLLIN;
+  e.data.u64 = makeKey(wakeFd, 0);
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &e) == -1) {
+    int errnum = errno;
+    ::close(wakeFd);
+    ::close(epollFd);
+    throw PlainException(u8string(u8"failed to watch an eventfd") + createStrerror(errnum));
+  }
+}
+
+Reactor::~Reactor () noexcept {
+  ::close(wakeFd);
+  ::close(epollFd);
+}
+
+void Reactor::add (int fd, Events events, Callback callback) {
+  DPRE(fd != -1);
+  DPRE(registrations.find(fd) == registrations.end());
+  iu32 generation = nextGeneration++;
+  if (generation == 0) {
+    generation = nextGeneration++;
+  }
+
+  epoll_event e;
+  e.events = events;
+  e.data.u64 = makeKey(fd, generation);
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &e) == -1) {
+    throw PlainException(u8string(u8"failed to watch a file descriptor") + createStrerror(errno));
+  }
+  registrations.emplace(fd, shared_ptr<Registration>(new Registration{generation, move(callback)}));
+}
+
+void Reactor::modify (int fd, Events events) {
+  auto i = registrations.find(fd);
+  DPRE(i != registrations.end());
+
+  epoll_event e;
+  e.events = events;
+  e.data.u64 = makeKey(fd, i->second->generation);
+  if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &e) == -1) {
+    throw PlainException(u8string(u8"failed to change the watch on a file descriptor") + createStrerror(errno));
+  }
+}
+
+void Reactor::remove (int fd) {
+  auto i = registrations.find(fd);
+  DPRE(i != registrations.end());
+  registrations.erase(i);
+  if (epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+    throw PlainException(u8string(u8"failed to stop watching a file descriptor") + createStrerror(errno));
+  }
+}
+
+size_t Reactor::runOnce (int timeout) {
+  constexpr int MAX_EVENTS = 256;
+  epoll_event events[MAX_EVENTS];
+  int r = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+  if (r == -1) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    throw PlainException(u8string(u8"failed to wait for file descriptors") + createStrerror(errno));
+  }
+
+  size_t callCount = 0;
+  for (int j = 0; j != r; ++j) {
+    const epoll_event &e = events[j];
+    auto fd = static_cast<int>(e.data.u64 & 0xFFFFFFFF);
+    auto generation = static_cast<iu32>(e.data.u64 >> 32);
+    if (generation == 0) {
+      iu64 dummy;
+      while (::read(wakeFd, &dummy, sizeof(dummy)) == sizeof(dummy));
+      std::vector<std::function<void ()>> functions;
+      {
+        std::lock_guard<std::mutex> l(postedLock);
+        swap(functions, posted);
+      }
+      for (auto &function : functions) {
+        function();
+        ++callCount;
+      }
+      continue;
+    }
+
+    // Skip events for file descriptors that were removed (and possibly
+    // re-added) by an earlier callback in this round.
+    auto i = registrations.find(fd);
+    if (i == registrations.end() || i->second->generation != generation) {
+      continue;
+    }
+    // (The callback may remove its own registration.)
+    shared_ptr<Registration> registration = i->second;
+    registration->callback(e.events);
+    ++callCount;
+  }
+  return callCount;
+}
+
+void Reactor::run () {
+  while (!stopping.exchange(false)) {
+    runOnce(-1);
+  }
+}
+
+void Reactor::post (std::function<void ()> function) {
+  {
+    std::lock_guard<std::mutex> l(postedLock);
+    posted.push_back(move(function));
+  }
+  iu64 one = 1;
+  ssize_t r = ::write(wakeFd, &one, sizeof(one));
+  static_cast<void>(r);
+}
+
+void Reactor::stop () noexcept {
+  stopping = true;
+  iu64 one = 1;
+  ssize_t r = ::write(wakeFd, &one, sizeof(one));
+  static_cast<void>(r);
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
@@ -0,0 +1,102 @@
+/** @file */
+/* -----------------------------------------------------------------------------
+   Event I/O Library
+   © Geoff Crossland 2017-2022
+----------------------------------------------------------------------------- */
+#ifndef IO_EVENT_ALREADYINCLUDED
+#define IO_EVENT_ALREADYINCLUDED
+
+#include <core.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <sys/epoll.h>
+
+namespace io::event {
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+extern DC();
+
+/**
+  An event loop that waits (via {@c epoll}) for file descriptors (such as
+  those of non-blocking sockets, listening or connected) to become ready, and
+  calls the callbacks registered for them. Registration methods may be called
+  from within callbacks, but an instance should otherwise be used only by the
+  thread running it (except for post() and stop()).
+*/
+class Reactor {
+  /**
+    A set of {@c epoll} event flags (e.g. {@c EPOLLIN}, {@c EPOLLOUT}).
+  */
+  pub typedef iu32 Events;
+  /**
+    A function to call with the events for which a file descriptor is ready.
+  */
+  pub typedef std::function<void (Events events)> Callback;
+
+  prv struct Registration {
+    iu32 generation;
+    Callback callback;
+  };
+
+  prv int epollFd;
+  prv int wakeFd;
+  prv iu32 nextGeneration;
+  prv std::unordered_map<int, std::shared_ptr<Registration>> registrations;
+  prv std::atomic<bool> stopping;
+  prv std::mutex postedLock;
+  prv std::vector<std::function<void ()>> posted;
+
+  pub Reactor ();
+  Reactor (const Reactor &) = delete;
+  Reactor &operator= (const Reactor &) = delete;
+  pub ~Reactor () noexcept;
+
+  /**
+    Starts watching the given file descriptor for the given events, calling
+    the given callback whenever it's ready for any of them.
+  */
+  pub void add (int fd, Events events, Callback callback);
+  /**
+    Changes the events for which the given (already-added) file descriptor
+    is watched.
+  */
+  pub void modify (int fd, Events events);
+  /**
+    Stops watching the given file descriptor (which must be done before it
+    is closed). Any events already collected for it are discarded.
+  */
+  pub void remove (int fd);
+  /**
+    Waits (for up to the given number of milliseconds, or indefinitely if
+    negative) for any watched file descriptors to be ready and calls their
+    callbacks.
+
+    @return the number of callbacks called.
+  */
+  pub size_t runOnce (int timeout);
+  /**
+    Arranges for the given function to be called on the thread running the
+    reactor (in the next round of callbacks). May be called from any thread.
+  */
+  pub void post (std::function<void ()> function);
+  /**
+    Calls runOnce() until stop() is called.
+  */
+  pub void run ();
+  /**
+    Makes run() return (after the current round of callbacks). May be called
+    from any thread.
+  */
+  pub void stop () noexcept;
+};
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
+
+#endif
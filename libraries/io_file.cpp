@@ -1,5 +1,10 @@
 #include "io_file.hpp"
 #include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace io::file {
 
@@ -8,6 +13,7 @@ using core::PlainException;
 using std::move;
 using core::unsign;
 using core::numeric_limits;
+using std::span;
 
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
@@ -36,7 +42,12 @@ u8string createStrerror (int errnum, const char8_t *prefix = u8" (", const char8
   return msg;
 }
 
-FileStream::FileStream (const u8string &pathName, Mode mode) {
+FileStream::FileStream (const u8string &pathName, Mode mode) : FileStream(pathName, mode, 0) {
+}
+
+constexpr size_t BUFFER_ALIGNMENT = 4096;
+
+FileStream::FileStream (const u8string &pathName, Mode mode, size_t bufferSize) : buffer(nullptr) {
   const char *m;
   switch (mode) {
     case Mode::readExisting:
@@ -67,10 +78,25 @@ FileStream::FileStream (const u8string &pathName, Mode mode) {
   }
   DI(state = State::free;)
 
-  setbuf(h, NULL);
+  if (bufferSize == 0) {
+    setbuf(h, NULL);
+    return;
+  }
+
+  if (bufferSize > numeric_limits<size_t>::max() - BUFFER_ALIGNMENT) {
+    fclose(h);
+    throw PlainException(u8string(u8"failed to set up buffering for '") + pathName + u8"' (requested buffer size was too big)");
+  }
+  bufferSize = (bufferSize + BUFFER_ALIGNMENT - 1) & ~(BUFFER_ALIGNMENT - 1);
+  buffer = static_cast<iu8f *>(aligned_alloc(BUFFER_ALIGNMENT, bufferSize));
+  if (!buffer || setvbuf(h, reinterpret_cast<char *>(buffer), _IOFBF, bufferSize) != 0) {
+    fclose(h);
+    freeBuffer();
+    throw PlainException(u8string(u8"failed to set up buffering for '") + pathName + u8"'");
+  }
 }
 
-FileStream::FileStream (FileStream &&o) noexcept : h(nullptr) {
+FileStream::FileStream (FileStream &&o) noexcept : h(nullptr), buffer(nullptr) {
   *this = move(o);
 }
 
@@ -79,8 +105,11 @@ FileStream &FileStream::operator= (FileStream &&o) noexcept {
     if (h) {
       fclose(h);
     }
+    freeBuffer();
     h = o.h;
     o.h = nullptr;
+    buffer = o.buffer;
+    o.buffer = nullptr;
     DI(state = o.state;)
   }
   return *this;
@@ -90,19 +119,26 @@ FileStream::~FileStream () {
   if (h) {
     fclose(h);
   }
+  freeBuffer();
+}
+
+void FileStream::freeBuffer () noexcept {
+  // The stdio stream must be closed before its buffer is released.
+  free(buffer);
+  buffer = nullptr;
 }
 
 FileStream::Size FileStream::tell () const {
-  long offset = ftell(h);
+  off_t offset = ftello(h);
   if (offset == -1) {
     throw PlainException(u8string(u8"failed to retrieve current position in file") + createStrerror(errno));
   }
   return unsign(offset);
 }
 
-void FileStream::seek (long offset, int origin) {
+void FileStream::seek (off_t offset, int origin) {
   errno = 0;
-  int r = fseek(h, offset, origin);
+  int r = fseeko(h, offset, origin);
   DI(state = State::free;)
   if (r != 0) {
     throw PlainException(u8string(u8"failed to set current position in file") + createStrerror(errno));
@@ -110,10 +146,10 @@ void FileStream::seek (long offset, int origin) {
 }
 
 void FileStream::seek (Size offset) {
-  if (offset > unsign(numeric_limits<long>::max())) {
+  if (offset > unsign(numeric_limits<off_t>::max())) {
     throw PlainException(u8string(u8"failed to set current position in file (requested position was too big)"));
   }
-  seek(static_cast<long>(offset), SEEK_SET);
+  seek(static_cast<off_t>(offset), SEEK_SET);
 }
 
 void FileStream::seekToEnd () {
@@ -132,28 +168,127 @@ size_t FileStream::read (iu8f *b, size_t s) {
     return 0;
   }
 
+  size_t outSize = tryRead(b, s).check();
+  return outSize == 0 ? numeric_limits<size_t>::max() : outSize;
+}
+
+void FileStream::write (const iu8f *b, size_t s) {
+  tryWrite(b, s).check();
+}
+
+io::Result FileStream::tryRead (iu8f *b, size_t s) noexcept {
+  DPRE(state == State::free || state == State::reading);
+  DPRE(s < numeric_limits<size_t>::max());
+  if (s == 0) {
+    return io::Result::ofError(EINVAL, u8"failed to read from file");
+  }
+
   DI(state = State::reading;)
   errno = 0;
   size_t outSize = fread(b, 1, s, h);
-  if (outSize == 0) {
-    if (feof(h)) {
-      return numeric_limits<size_t>::max();
-    }
+  if (outSize == 0 && !feof(h)) {
     DA(ferror(h));
-    throw PlainException(u8string(u8"failed to read from file") + createStrerror(errno));
+    return io::Result::ofError(errno != 0 ? errno : EIO, u8"failed to read from file");
   }
-
-  return outSize;
+  return io::Result::ofSize(outSize);
 }
 
-void FileStream::write (const iu8f *b, size_t s) {
+io::Result FileStream::tryWrite (const iu8f *b, size_t s) noexcept {
   DPRE(state == State::free || state == State::writing);
   DI(state = State::writing;)
   errno = 0;
   size_t outSize = fwrite(b, 1, s, h);
   if (outSize != s) {
+    return io::Result::ofError(errno != 0 ? errno : EIO, u8"failed to write to file");
+  }
+  return io::Result::ofSize(outSize);
+}
+
+void FileStream::resync () {
+  // After accessing the file through its descriptor, the stdio stream must be
+  // explicitly repositioned before it's used again (and the target position
+  // will never lie within the stream's stale read buffer, so the stream has to
+  // go to the system for it).
+  off_t offset = lseek(fileno(h), 0, SEEK_CUR);
+  if (offset == -1) {
+    throw PlainException(u8string(u8"failed to retrieve current position in file") + createStrerror(errno));
+  }
+  seek(offset, SEEK_SET);
+}
+
+size_t FileStream::readv (const iovec *v, size_t vSize) {
+  DPRE(state == State::free || state == State::reading);
+  size_t s = io::getSize(v, vSize);
+  DPRE(s < numeric_limits<size_t>::max());
+  if (s == 0) {
+    return 0;
+  }
+
+  // Bring the descriptor's position into line with the stream's (dropping
+  // any read-ahead data).
+  errno = 0;
+  if (fflush(h) != 0) {
+    throw PlainException(u8string(u8"failed to read from file") + createStrerror(errno));
+  }
+  ssize_t outSize;
+  do {
+    outSize = ::readv(fileno(h), v, static_cast<int>(vSize < IOV_MAX ? vSize : IOV_MAX));
+  } while (outSize == -1 && errno == EINTR);
+  if (outSize == -1) {
+    throw PlainException(u8string(u8"failed to read from file") + createStrerror(errno));
+  }
+  resync();
+  DI(state = State::reading;)
+
+  if (outSize == 0) {
+    return numeric_limits<size_t>::max();
+  }
+  return static_cast<size_t>(outSize);
+}
+
+void FileStream::writev (const iovec *v, size_t vSize) {
+  DPRE(state == State::free || state == State::writing);
+  errno = 0;
+  if (fflush(h) != 0) {
     throw PlainException(u8string(u8"failed to write to file") + createStrerror(errno));
   }
+  int fd = fileno(h);
+  io::writeAll(v, vSize, [&] (const iovec *w, size_t wSize) -> size_t {
+    ssize_t outSize;
+    do {
+      outSize = ::writev(fd, w, static_cast<int>(wSize));
+    } while (outSize == -1 && errno == EINTR);
+    if (outSize == -1) {
+      throw PlainException(u8string(u8"failed to write to file") + createStrerror(errno));
+    }
+    return static_cast<size_t>(outSize);
+  });
+  resync();
+  DI(state = State::writing;)
+}
+
+void FileStream::flush () {
+  tryFlush().check();
+}
+
+io::Result FileStream::tryFlush () noexcept {
+  DPRE(state == State::free || state == State::writing);
+  errno = 0;
+  if (fflush(h) != 0) {
+    return io::Result::ofError(errno != 0 ? errno : EIO, u8"failed to write to file");
+  }
+  return io::Result::ofSize(0);
+}
+
+void FileStream::flushToStorage () {
+  flush();
+  int r;
+  do {
+    r = fdatasync(fileno(h));
+  } while (r != 0 && errno == EINTR);
+  if (r != 0) {
+    throw PlainException(u8string(u8"failed to flush file to storage") + createStrerror(errno));
+  }
 }
 
 void FileStream::close () {
@@ -163,6 +298,711 @@ void FileStream::close () {
 
   int r = fclose(h);
   h = nullptr;
+  freeBuffer();
+  if (r != 0) {
+    throw PlainException(u8string(u8"failed to close file") + createStrerror(errno));
+  }
+}
+
+RandomAccessFile::RandomAccessFile (const u8string &pathName, FileStream::Mode mode, int extraFlags) {
+  int flags;
+  switch (mode) {
+    case FileStream::Mode::readExisting:
+      flags = O_RDONLY;
+      break;
+    case FileStream::Mode::readWriteExisting:
+      flags = O_RDWR;
+      break;
+    case FileStream::Mode::readWriteRecreate:
+      flags = O_RDWR | O_CREAT | O_TRUNC;
+      break;
+    case FileStream::Mode::appendCreate:
+      flags = O_WRONLY | O_CREAT | O_APPEND;
+      break;
+    case FileStream::Mode::readAppendCreate:
+      flags = O_RDWR | O_CREAT | O_APPEND;
+      break;
+    default:
+      DPRE(false);
+      flags = O_RDONLY;
+  }
+
+  // TODO handle path name correctly
+  fd = ::open(reinterpret_cast<const char *>(pathName.c_str()), flags | extraFlags | O_CLOEXEC, 0666);
+  if (fd == -1) {
+    throw PlainException(u8string(u8"failed to open '") + pathName + u8"'" + createStrerror(errno));
+  }
+}
+
+RandomAccessFile::RandomAccessFile (const u8string &pathName, FileStream::Mode mode) : RandomAccessFile(pathName, mode, 0) {
+}
+
+RandomAccessFile::RandomAccessFile (RandomAccessFile &&o) noexcept : fd(-1) {
+  *this = move(o);
+}
+
+RandomAccessFile &RandomAccessFile::operator= (RandomAccessFile &&o) noexcept {
+  if (this != &o) {
+    if (fd != -1) {
+      ::close(fd);
+    }
+    fd = o.fd;
+    o.fd = -1;
+  }
+  return *this;
+}
+
+RandomAccessFile::~RandomAccessFile () {
+  if (fd != -1) {
+    ::close(fd);
+  }
+}
+
+int RandomAccessFile::getDescriptor () const noexcept {
+  return fd;
+}
+
+RandomAccessFile::Offset RandomAccessFile::getSize () const {
+  DPRE(fd != -1);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    throw PlainException(u8string(u8"failed to get the size of file") + createStrerror(errno));
+  }
+  return unsign(st.st_size);
+}
+
+size_t RandomAccessFile::readAt (Offset offset, iu8f *b, size_t s) const {
+  DPRE(fd != -1);
+  DPRE(s < numeric_limits<size_t>::max());
+  if (offset > unsign(numeric_limits<off_t>::max())) {
+    throw PlainException(u8string(u8"failed to read from file (requested position was too big)"));
+  }
+  if (s == 0) {
+    return 0;
+  }
+
+  ssize_t outSize;
+  do {
+    outSize = pread(fd, b, s, static_cast<off_t>(offset));
+  } while (outSize == -1 && errno == EINTR);
+  if (outSize == -1) {
+    throw PlainException(u8string(u8"failed to read from file") + createStrerror(errno));
+  }
+  if (outSize == 0) {
+    return numeric_limits<size_t>::max();
+  }
+
+  return static_cast<size_t>(outSize);
+}
+
+void RandomAccessFile::writeAt (Offset offset, const iu8f *b, size_t s) {
+  DPRE(fd != -1);
+  while (s != 0) {
+    if (offset > unsign(numeric_limits<off_t>::max())) {
+      throw PlainException(u8string(u8"failed to write to file (requested position was too big)"));
+    }
+    ssize_t outSize_ = pwrite(fd, b, s, static_cast<off_t>(offset));
+    if (outSize_ == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw PlainException(u8string(u8"failed to write to file") + createStrerror(errno));
+    }
+    auto outSize = static_cast<size_t>(outSize_);
+    DA(outSize <= s);
+
+    b += outSize;
+    s -= outSize;
+    offset += outSize;
+  }
+}
+
+void RandomAccessFile::flushToStorage () {
+  DPRE(fd != -1);
+  int r;
+  do {
+    r = fdatasync(fd);
+  } while (r != 0 && errno == EINTR);
+  if (r != 0) {
+    throw PlainException(u8string(u8"failed to flush file to storage") + createStrerror(errno));
+  }
+}
+
+void RandomAccessFile::close () {
+  if (fd == -1) {
+    return;
+  }
+
+  int r = ::close(fd);
+  fd = -1;
+  if (r != 0) {
+    throw PlainException(u8string(u8"failed to close file") + createStrerror(errno));
+  }
+}
+
+void flushDirectoryEntryToStorage (const u8string &pathName) {
+  size_t i = pathName.rfind(u8'/');
+  u8string dirPathName = i == u8string::npos ? u8string(u8".") : i == 0 ? u8string(u8"/") : u8string(pathName.c_str(), i);
+
+  // TODO handle path name correctly
+  int fd = ::open(reinterpret_cast<const char *>(dirPathName.c_str()), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    throw PlainException(u8string(u8"failed to open directory '") + dirPathName + u8"'" + createStrerror(errno));
+  }
+  int r;
+  do {
+    r = fsync(fd);
+  } while (r != 0 && errno == EINTR);
+  int errnum = errno;
+  ::close(fd);
+  if (r != 0) {
+    throw PlainException(u8string(u8"failed to flush directory '") + dirPathName + u8"' to storage" + createStrerror(errnum));
+  }
+}
+
+bool isPowerOf2 (size_t n) noexcept {
+  return n != 0 && (n & (n - 1)) == 0;
+}
+
+DirectFile::DirectFile (const u8string &pathName, FileStream::Mode mode, size_t alignment) : file(pathName, mode, O_DIRECT), alignment(alignment), position(0) {
+  DPRE(isPowerOf2(alignment));
+}
+
+size_t DirectFile::getAlignment () const noexcept {
+  return alignment;
+}
+
+bool DirectFile::isAligned (Offset offset, const void *b, size_t s) const noexcept {
+  return ((offset | reinterpret_cast<uintptr_t>(b) | s) & (alignment - 1)) == 0;
+}
+
+void DirectFile::checkAligned (Offset offset, const void *b, size_t s) const {
+  if (!isAligned(offset, b, s)) {
+    throw PlainException(u8string(u8"failed to access file (position, buffer address or size was not suitably aligned for direct I/O)"));
+  }
+}
+
+DirectFile::Offset DirectFile::getSize () const {
+  return file.getSize();
+}
+
+void DirectFile::setSize (Offset size) {
+  DPRE(file.fd != -1);
+  if (size > unsign(numeric_limits<off_t>::max())) {
+    throw PlainException(u8string(u8"failed to set the size of file (requested size was too big)"));
+  }
+  if (ftruncate(file.fd, static_cast<off_t>(size)) != 0) {
+    throw PlainException(u8string(u8"failed to set the size of file") + createStrerror(errno));
+  }
+}
+
+size_t DirectFile::readAt (Offset offset, iu8f *b, size_t s) const {
+  checkAligned(offset, b, s);
+  return file.readAt(offset, b, s);
+}
+
+void DirectFile::writeAt (Offset offset, const iu8f *b, size_t s) {
+  checkAligned(offset, b, s);
+  file.writeAt(offset, b, s);
+}
+
+DirectFile::Offset DirectFile::tell () const noexcept {
+  return position;
+}
+
+void DirectFile::seek (Offset offset) {
+  checkAligned(offset, nullptr, 0);
+  position = offset;
+}
+
+size_t DirectFile::read (iu8f *b, size_t s) {
+  if ((position & (alignment - 1)) != 0) {
+    // Only a short read at the end of the file leaves the position unaligned.
+    return numeric_limits<size_t>::max();
+  }
+  size_t outSize = readAt(position, b, s);
+  if (outSize != numeric_limits<size_t>::max()) {
+    position += outSize;
+  }
+  return outSize;
+}
+
+void DirectFile::write (const iu8f *b, size_t s) {
+  writeAt(position, b, s);
+  position += s;
+}
+
+void DirectFile::close () {
+  file.close();
+}
+
+AlignedBufferPool::Buffer::Buffer (AlignedBufferPool *pool, iu8f *b) noexcept : pool(pool), b(b) {
+}
+
+AlignedBufferPool::Buffer::Buffer () noexcept : pool(nullptr), b(nullptr) {
+}
+
+AlignedBufferPool::Buffer::Buffer (Buffer &&o) noexcept : pool(nullptr), b(nullptr) {
+  *this = move(o);
+}
+
+AlignedBufferPool::Buffer &AlignedBufferPool::Buffer::operator= (Buffer &&o) noexcept {
+  if (this != &o) {
+    release();
+    pool = o.pool;
+    b = o.b;
+    o.pool = nullptr;
+    o.b = nullptr;
+  }
+  return *this;
+}
+
+AlignedBufferPool::Buffer::~Buffer () noexcept {
+  release();
+}
+
+AlignedBufferPool::Buffer::operator bool () const noexcept {
+  return b;
+}
+
+iu8f *AlignedBufferPool::Buffer::get () const noexcept {
+  return b;
+}
+
+size_t AlignedBufferPool::Buffer::getSize () const noexcept {
+  return pool ? pool->bufferSize : 0;
+}
+
+void AlignedBufferPool::Buffer::release () noexcept {
+  if (b) {
+    pool->giveBack(b);
+    pool = nullptr;
+    b = nullptr;
+  }
+}
+
+AlignedBufferPool::AlignedBufferPool (size_t bufferSize, size_t bufferCount, size_t alignment) : storage(nullptr), bufferSize(bufferSize) {
+  DPRE(isPowerOf2(alignment));
+  DPRE(bufferSize % alignment == 0);
+  DPRE(bufferCount != 0);
+  if (bufferSize > numeric_limits<size_t>::max() / bufferCount) {
+    throw PlainException(u8string(u8"failed to create buffer pool (requested size was too big)"));
+  }
+  storage = static_cast<iu8f *>(aligned_alloc(alignment, bufferSize * bufferCount));
+  if (!storage) {
+    throw PlainException(u8string(u8"failed to create buffer pool") + createStrerror(errno));
+  }
+
+  available.reserve(bufferCount);
+  for (size_t i = bufferCount; i != 0; --i) {
+    available.push_back(storage + (i - 1) * bufferSize);
+  }
+  storageSize = bufferSize * bufferCount;
+}
+
+AlignedBufferPool::~AlignedBufferPool () noexcept {
+  DPRE(available.size() == storageSize / bufferSize);
+  free(storage);
+}
+
+size_t AlignedBufferPool::getBufferSize () const noexcept {
+  return bufferSize;
+}
+
+iovec AlignedBufferPool::getStorage () const noexcept {
+  return iovec{storage, storageSize};
+}
+
+AlignedBufferPool::Buffer AlignedBufferPool::borrow () {
+  std::unique_lock<std::mutex> l(lock);
+  bufferAvailable.wait(l, [&] () {
+    return !available.empty();
+  });
+  iu8f *b = available.back();
+  available.pop_back();
+  return Buffer(this, b);
+}
+
+AlignedBufferPool::Buffer AlignedBufferPool::tryBorrow () {
+  std::lock_guard<std::mutex> l(lock);
+  if (available.empty()) {
+    return Buffer();
+  }
+  iu8f *b = available.back();
+  available.pop_back();
+  return Buffer(this, b);
+}
+
+void AlignedBufferPool::giveBack (iu8f *b) noexcept {
+  {
+    std::lock_guard<std::mutex> l(lock);
+    available.push_back(b);
+  }
+  bufferAvailable.notify_one();
+}
+
+ScanFile::ScanFile (const u8string &pathName, size_t blockSize, size_t blockCount) : file(pathName, FileStream::Mode::readExisting), blockSize(blockSize), blocks(blockCount), index(0), offset(0), availableCount(0), position(0), filledCount(0), stopping(false) {
+  DPRE(blockSize != 0);
+  DPRE(blockCount != 0);
+  for (Block &block : blocks) {
+    block.b.reset(new iu8f[blockSize]);
+    block.size = 0;
+    block.end = false;
+    block.errnum = 0;
+  }
+
+  // These are only hints, so failure is of no consequence.
+  posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(file.fd, 0, static_cast<off_t>(blockSize * blockCount), POSIX_FADV_WILLNEED);
+
+  prefetcher = std::thread([this] () {
+    prefetch();
+  });
+}
+
+ScanFile::~ScanFile () noexcept {
+  stop();
+}
+
+void ScanFile::prefetch () {
+  size_t blockCount = blocks.size();
+  Offset fileOffset = 0;
+  for (size_t i = 0;; i = (i + 1) % blockCount) {
+    {
+      std::unique_lock<std::mutex> l(lock);
+      blockEmptied.wait(l, [&] () {
+        return stopping || filledCount != blockCount;
+      });
+      if (stopping) {
+        return;
+      }
+    }
+
+    // Fill the block completely (unless the end of the file is reached).
+    Block &block = blocks[i];
+    block.size = 0;
+    while (block.size != blockSize) {
+      ssize_t r = pread(file.fd, block.b.get() + block.size, blockSize - block.size, static_cast<off_t>(fileOffset));
+      if (r == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        block.errnum = errno;
+        break;
+      }
+      if (r == 0) {
+        block.end = true;
+        break;
+      }
+      block.size += static_cast<size_t>(r);
+      fileOffset += static_cast<size_t>(r);
+    }
+    if (!block.end && block.errnum == 0) {
+      // Have the system start on the block beyond the prefetch window.
+      readahead(file.fd, static_cast<off64_t>(fileOffset + (blockCount - 1) * blockSize), blockSize);
+    }
+
+    {
+      std::lock_guard<std::mutex> l(lock);
+      ++filledCount;
+    }
+    blockFilled.notify_one();
+    if (block.end || block.errnum != 0) {
+      return;
+    }
+  }
+}
+
+void ScanFile::stop () noexcept {
+  if (!prefetcher.joinable()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> l(lock);
+    stopping = true;
+  }
+  blockEmptied.notify_one();
+  prefetcher.join();
+}
+
+ScanFile::Offset ScanFile::tell () const noexcept {
+  return position;
+}
+
+size_t ScanFile::read (iu8f *b, size_t s) {
+  DPRE(prefetcher.joinable());
+  DPRE(s < numeric_limits<size_t>::max());
+  if (s == 0) {
+    return 0;
+  }
+
+  if (availableCount == 0) {
+    std::unique_lock<std::mutex> l(lock);
+    blockFilled.wait(l, [&] () {
+      return filledCount != 0;
+    });
+    availableCount = filledCount;
+  }
+
+  Block &block = blocks[index];
+  if (block.errnum != 0 && offset == block.size) {
+    throw PlainException(u8string(u8"failed to read from file") + createStrerror(block.errnum));
+  }
+  if (block.end && offset == block.size) {
+    return numeric_limits<size_t>::max();
+  }
+
+  size_t outSize = block.size - offset;
+  if (outSize > s) {
+    outSize = s;
+  }
+  memcpy(b, block.b.get() + offset, outSize);
+  offset += outSize;
+  position += outSize;
+
+  if (offset == block.size && !block.end && block.errnum == 0) {
+    // Hand the block back to the prefetcher.
+    {
+      std::lock_guard<std::mutex> l(lock);
+      --filledCount;
+      availableCount = filledCount;
+    }
+    blockEmptied.notify_one();
+    index = (index + 1) % blocks.size();
+    offset = 0;
+  }
+
+  return outSize;
+}
+
+void ScanFile::close () {
+  stop();
+  file.close();
+}
+
+MappedFile::MappedFile (const u8string &pathName) : data(nullptr), size(0), position(0) {
+  // TODO handle path name correctly
+  fd = ::open(reinterpret_cast<const char *>(pathName.c_str()), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    throw PlainException(u8string(u8"failed to open '") + pathName + u8"'" + createStrerror(errno));
+  }
+
+  try {
+    map();
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+}
+
+MappedFile::MappedFile (MappedFile &&o) noexcept : fd(-1), data(nullptr), size(0), position(0) {
+  *this = move(o);
+}
+
+MappedFile &MappedFile::operator= (MappedFile &&o) noexcept {
+  if (this != &o) {
+    unmap();
+    if (fd != -1) {
+      ::close(fd);
+    }
+    fd = o.fd;
+    data = o.data;
+    size = o.size;
+    position = o.position;
+    o.fd = -1;
+    o.data = nullptr;
+    o.size = 0;
+    o.position = 0;
+  }
+  return *this;
+}
+
+MappedFile::~MappedFile () {
+  unmap();
+  if (fd != -1) {
+    ::close(fd);
+  }
+}
+
+void MappedFile::map () {
+  DPRE(fd != -1);
+  DPRE(!data);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    throw PlainException(u8string(u8"failed to get the size of file") + createStrerror(errno));
+  }
+  if (unsign(st.st_size) > numeric_limits<size_t>::max()) {
+    throw PlainException(u8string(u8"failed to map file (file was too big)"));
+  }
+  size = unsign(st.st_size);
+  if (size == 0) {
+    // There's nothing to map (and mmap() rejects zero-length mappings).
+    return;
+  }
+
+  void *d = mmap(nullptr, static_cast<size_t>(size), PROT_READ, MAP_SHARED, fd, 0);
+  if (d == MAP_FAILED) {
+    size = 0;
+    throw PlainException(u8string(u8"failed to map file") + createStrerror(errno));
+  }
+  data = static_cast<const iu8f *>(d);
+}
+
+void MappedFile::unmap () noexcept {
+  if (data) {
+    munmap(const_cast<iu8f *>(data), static_cast<size_t>(size));
+    data = nullptr;
+  }
+  size = 0;
+}
+
+MappedFile::Size MappedFile::getSize () const noexcept {
+  return size;
+}
+
+span<const iu8f> MappedFile::view () const noexcept {
+  return span<const iu8f>(data, static_cast<size_t>(size));
+}
+
+span<const iu8f> MappedFile::view (Size offset, Size s) const {
+  if (offset > size || s > size - offset) {
+    throw PlainException(u8string(u8"failed to get a view of file (requested range was outside the file)"));
+  }
+  return span<const iu8f>(data + offset, static_cast<size_t>(s));
+}
+
+bool MappedFile::remap () {
+  DPRE(fd != -1);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    throw PlainException(u8string(u8"failed to get the size of file") + createStrerror(errno));
+  }
+  if (unsign(st.st_size) == size) {
+    return false;
+  }
+  if (unsign(st.st_size) > numeric_limits<size_t>::max()) {
+    throw PlainException(u8string(u8"failed to map file (file was too big)"));
+  }
+
+  Size newSize = unsign(st.st_size);
+  if (!data || newSize == 0) {
+    unmap();
+    try {
+      map();
+    } catch (...) {
+      // (Leave the instance consistent, with nothing mapped.)
+      position = 0;
+      throw;
+    }
+  } else {
+    void *d = mremap(const_cast<iu8f *>(data), static_cast<size_t>(size), static_cast<size_t>(newSize), MREMAP_MAYMOVE);
+    if (d == MAP_FAILED) {
+      throw PlainException(u8string(u8"failed to remap file") + createStrerror(errno));
+    }
+    data = static_cast<const iu8f *>(d);
+    size = newSize;
+  }
+
+  if (position > size) {
+    position = size;
+  }
+  return true;
+}
+
+void MappedFile::advise (Advice advice) {
+  advise(advice, 0, size);
+}
+
+void MappedFile::advise (Advice advice, Size offset, Size s) {
+  if (offset > size || s > size - offset) {
+    throw PlainException(u8string(u8"failed to advise on file access (requested range was outside the file)"));
+  }
+  if (s == 0) {
+    return;
+  }
+
+  int a;
+  switch (advice) {
+    case Advice::normal:
+      a = MADV_NORMAL;
+      break;
+    case Advice::sequential:
+      a = MADV_SEQUENTIAL;
+      break;
+    case Advice::random:
+      a = MADV_RANDOM;
+      break;
+    case Advice::willNeed:
+      a = MADV_WILLNEED;
+      break;
+    case Advice::dontNeed:
+      a = MADV_DONTNEED;
+      break;
+    default:
+      DPRE(false);
+      a = MADV_NORMAL;
+  }
+
+  // madvise() requires a page-aligned start address.
+  Size pageSize = unsign(sysconf(_SC_PAGESIZE));
+  Size alignedOffset = offset - (offset % pageSize);
+  int r = madvise(const_cast<iu8f *>(data) + alignedOffset, static_cast<size_t>(s + (offset - alignedOffset)), a);
+  if (r != 0) {
+    throw PlainException(u8string(u8"failed to advise on file access") + createStrerror(errno));
+  }
+}
+
+MappedFile::Size MappedFile::tell () const noexcept {
+  return position;
+}
+
+void MappedFile::seek (Size offset) {
+  if (offset > size) {
+    throw PlainException(u8string(u8"failed to set current position in file (requested position was beyond the end of the file)"));
+  }
+  position = offset;
+}
+
+void MappedFile::seekToEnd () noexcept {
+  position = size;
+}
+
+size_t MappedFile::read (iu8f *b, size_t s) {
+  DPRE(s < numeric_limits<size_t>::max());
+  if (s == 0) {
+    return 0;
+  }
+
+  span<const iu8f> v = readView(s);
+  if (v.empty()) {
+    return numeric_limits<size_t>::max();
+  }
+  memcpy(b, v.data(), v.size());
+  return v.size();
+}
+
+span<const iu8f> MappedFile::readView (size_t s) {
+  DPRE(position <= size);
+  Size available = size - position;
+  if (s > available) {
+    s = static_cast<size_t>(available);
+  }
+
+  span<const iu8f> v(data + position, s);
+  position += s;
+  return v;
+}
+
+void MappedFile::close () {
+  if (fd == -1) {
+    return;
+  }
+
+  unmap();
+  position = 0;
+  int r = ::close(fd);
+  fd = -1;
   if (r != 0) {
     throw PlainException(u8string(u8"failed to close file") + createStrerror(errno));
   }
@@ -6,7 +6,15 @@
 #ifndef IO_FILE_ALREADYINCLUDED
 #define IO_FILE_ALREADYINCLUDED
 
+#include "io.hpp"
 #include <core.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
 
 namespace io::file {
 
@@ -35,24 +43,38 @@ class FileStream {
   };
 
   prv FILE *h;
+  prv iu8f *buffer;
   DI(prv enum class State {
     free,
     reading,
     writing
   } state;)
 
+  /**
+    Opens the given file without user-space buffering (so each read() and
+    write() goes straight to the system).
+  */
   pub FileStream (const core::u8string &pathName, Mode mode);
+  /**
+    Opens the given file with a user-space buffer of (at least) the given size,
+    allocated on a page boundary. write()s are accumulated in the buffer until
+    it is full or until flush(), sync() or close() is called, and read()s are
+    satisfied from the buffer where possible. A buffer size of zero is
+    equivalent to using the unbuffered constructor.
+  */
+  pub FileStream (const core::u8string &pathName, Mode mode, size_t bufferSize);
   FileStream (const FileStream &) = delete;
   FileStream &operator= (const FileStream &) = delete;
   pub FileStream (FileStream &&) noexcept;
   pub FileStream &operator= (FileStream &&) noexcept;
   pub ~FileStream ();
 
+  prv void freeBuffer () noexcept;
   /**
     Gets the current position in the file.
   */
   pub Size tell () const;
-  prv void seek (long offset, int origin);
+  prv void seek (off_t offset, int origin);
   /**
     Sets the current position in the file.
   */
@@ -67,9 +89,394 @@ class FileStream {
   pub void sync ();
   pub size_t read (iu8f *b, size_t s);
   pub void write (const iu8f *b, size_t s);
+  /**
+    Reads as for read(), returning (rather than throwing) any failure, and
+    gives a size of zero at the end of the file. A request for zero bytes
+    fails with {@c EINVAL}, so that a size of zero is unambiguous.
+  */
+  pub io::Result tryRead (iu8f *b, size_t s) noexcept;
+  /**
+    Writes as for write(), but returns (rather than throws) any failure.
+  */
+  pub io::Result tryWrite (const iu8f *b, size_t s) noexcept;
+  prv void resync ();
+  /**
+    Reads (with a single system call) into the buffers described by the given
+    sequence of {@c iovec}s, filling each in turn, returning the total number of
+    bytes read or, at the end of the file, {@c numeric_limits<size_t>::max()}.
+  */
+  pub size_t readv (const iovec *v, size_t vSize);
+  /**
+    Writes all of the data described by the given sequence of {@c iovec}s
+    (with a single system call, unless the system accepts only part of the
+    data).
+  */
+  pub void writev (const iovec *v, size_t vSize);
+  /**
+    Passes any data buffered by write() to the system.
+  */
+  pub void flush ();
+  /**
+    Flushes as for flush(), but returns (rather than throws) any failure.
+  */
+  pub io::Result tryFlush () noexcept;
+  /**
+    Passes any data buffered by write() to the system and waits until all data
+    written to the file (plus any metadata needed to read it back) has reached
+    stable storage (via {@c fdatasync}).
+  */
+  pub void flushToStorage ();
+  pub void close ();
+};
+
+static_assert(io::InputStream<FileStream> && io::OutputStream<FileStream>);
+
+/**
+  A file accessed through a raw descriptor at explicitly-given positions (via
+  {@c pread} and {@c pwrite}), rather than at a shared current position. Since
+  no state is changed by readAt() or writeAt(), an instance may be used by many
+  threads at once without locking.
+*/
+class RandomAccessFile {
+  pub typedef iu64 Offset;
+
+  prv int fd;
+
+  prv RandomAccessFile (const core::u8string &pathName, FileStream::Mode mode, int extraFlags);
+  /**
+    Opens the given file. Note that, as for {@c pwrite}, writeAt() on a file
+    opened with {@c Mode::appendCreate} or {@c Mode::readAppendCreate} appends
+    to the end of the file, regardless of the given offset.
+  */
+  pub RandomAccessFile (const core::u8string &pathName, FileStream::Mode mode);
+  RandomAccessFile (const RandomAccessFile &) = delete;
+  RandomAccessFile &operator= (const RandomAccessFile &) = delete;
+  pub RandomAccessFile (RandomAccessFile &&) noexcept;
+  pub RandomAccessFile &operator= (RandomAccessFile &&) noexcept;
+  pub ~RandomAccessFile ();
+
+  /**
+    Gets the file descriptor (e.g. for use with an io::async::FileEngine).
+  */
+  pub int getDescriptor () const noexcept;
+  /**
+    Gets the current size of the file.
+  */
+  pub Offset getSize () const;
+  /**
+    Reads up to the given number of bytes from the given position in the file,
+    returning the number read or, at the end of the file,
+    {@c numeric_limits<size_t>::max()}.
+  */
+  pub size_t readAt (Offset offset, iu8f *b, size_t s) const;
+  /**
+    Writes all of the given bytes at the given position in the file.
+  */
+  pub void writeAt (Offset offset, const iu8f *b, size_t s);
+  /**
+    Waits until all data written to the file (plus any metadata needed to read
+    it back) has reached stable storage (via {@c fdatasync}).
+  */
+  pub void flushToStorage ();
+  pub void close ();
+
+  friend class DirectFile;
+  friend class ScanFile;
+};
+
+/**
+  Waits until the entry for the given file in its directory (e.g. after
+  its creation or renaming) has reached stable storage.
+*/
+void flushDirectoryEntryToStorage (const core::u8string &pathName);
+
+/**
+  A file accessed with direct I/O ({@c O_DIRECT}), bypassing the system's
+  page cache. The position, the buffer address and the size of each read and
+  write must all be multiples of the file's alignment (see AlignedBufferPool
+  for a source of suitable buffers); the final, partial block of a file can be
+  written padded and then trimmed off with setSize(). An instance is also an
+  {@c InputStream} and {@c OutputStream} (with the same restrictions).
+*/
+class DirectFile {
+  pub typedef RandomAccessFile::Offset Offset;
+
+  prv RandomAccessFile file;
+  prv size_t alignment;
+  prv Offset position;
+
+  /**
+    Opens the given file for direct I/O, with the given alignment (which must
+    be a power of two and at least the logical block size of the file's
+    device).
+
+    @throw if the file's filesystem doesn't support direct I/O.
+  */
+  pub DirectFile (const core::u8string &pathName, FileStream::Mode mode, size_t alignment = 4096);
+
+  pub size_t getAlignment () const noexcept;
+  /**
+    Determines whether the given position, buffer address and size meet the
+    file's alignment requirements.
+  */
+  pub bool isAligned (Offset offset, const void *b, size_t s) const noexcept;
+  prv void checkAligned (Offset offset, const void *b, size_t s) const;
+  pub Offset getSize () const;
+  /**
+    Truncates or extends the file to the given size (which need not be
+    aligned).
+  */
+  pub void setSize (Offset size);
+  /**
+    Reads up to the given number of bytes from the given position in the file
+    (as for RandomAccessFile::readAt()).
+
+    @throw if the arguments aren't suitably aligned.
+  */
+  pub size_t readAt (Offset offset, iu8f *b, size_t s) const;
+  /**
+    Writes all of the given bytes at the given position in the file.
+
+    @throw if the arguments aren't suitably aligned.
+  */
+  pub void writeAt (Offset offset, const iu8f *b, size_t s);
+  /**
+    Gets the current position in the file.
+  */
+  pub Offset tell () const noexcept;
+  /**
+    Sets the current position in the file.
+
+    @throw if the position isn't suitably aligned.
+  */
+  pub void seek (Offset offset);
+  pub size_t read (iu8f *b, size_t s);
+  pub void write (const iu8f *b, size_t s);
+  pub void close ();
+};
+
+static_assert(io::InputStream<DirectFile> && io::OutputStream<DirectFile>);
+
+/**
+  A fixed set of equally-sized, aligned buffers (carved from a single
+  allocation), which can be borrowed and returned by any thread.
+*/
+class AlignedBufferPool {
+  /**
+    A borrowed buffer, which is returned to its pool on destruction.
+  */
+  pub class Buffer {
+    prv AlignedBufferPool *pool;
+    prv iu8f *b;
+
+    prv Buffer (AlignedBufferPool *pool, iu8f *b) noexcept;
+    /**
+      Creates an empty instance (which refers to no buffer).
+    */
+    pub Buffer () noexcept;
+    Buffer (const Buffer &) = delete;
+    Buffer &operator= (const Buffer &) = delete;
+    pub Buffer (Buffer &&) noexcept;
+    pub Buffer &operator= (Buffer &&) noexcept;
+    pub ~Buffer () noexcept;
+
+    pub explicit operator bool () const noexcept;
+    pub iu8f *get () const noexcept;
+    pub size_t getSize () const noexcept;
+    /**
+      Returns the buffer to its pool early, leaving this instance empty.
+    */
+    pub void release () noexcept;
+
+    friend class AlignedBufferPool;
+  };
+
+  prv iu8f *storage;
+  prv size_t storageSize;
+  prv size_t bufferSize;
+  prv std::mutex lock;
+  prv std::condition_variable bufferAvailable;
+  prv std::vector<iu8f *> available;
+
+  /**
+    Creates a pool of the given number of buffers, each of the given size
+    (which must be a multiple of the given alignment, which must be a power of
+    two). All of the buffers must have been returned before the pool is
+    destroyed.
+  */
+  pub AlignedBufferPool (size_t bufferSize, size_t bufferCount, size_t alignment = 4096);
+  AlignedBufferPool (const AlignedBufferPool &) = delete;
+  AlignedBufferPool &operator= (const AlignedBufferPool &) = delete;
+  pub ~AlignedBufferPool () noexcept;
+
+  pub size_t getBufferSize () const noexcept;
+  /**
+    Gets the single region of memory that holds all of the buffers (e.g. for
+    io::async::FileEngine::registerBuffers()).
+  */
+  pub iovec getStorage () const noexcept;
+  /**
+    Borrows a buffer, waiting until one is available.
+  */
+  pub Buffer borrow ();
+  /**
+    Borrows a buffer if one is available, or else returns an empty Buffer.
+  */
+  pub Buffer tryBorrow ();
+  prv void giveBack (iu8f *b) noexcept;
+};
+
+/**
+  An {@c InputStream} for reading a whole file from front to back. The system
+  is advised that access will be sequential, and a background thread
+  prefetches a window of blocks ahead of the caller, so that the caller can be
+  processing one block while the following ones are being read.
+*/
+class ScanFile {
+  pub typedef RandomAccessFile::Offset Offset;
+
+  prv struct Block {
+    std::unique_ptr<iu8f[]> b;
+    size_t size;
+    bool end;
+    int errnum;
+  };
+
+  prv RandomAccessFile file;
+  prv size_t blockSize;
+  prv std::vector<Block> blocks;
+  prv size_t index;
+  prv size_t offset;
+  prv size_t availableCount;
+  prv Offset position;
+  prv std::mutex lock;
+  prv std::condition_variable blockFilled;
+  prv std::condition_variable blockEmptied;
+  prv size_t filledCount;
+  prv bool stopping;
+  prv std::thread prefetcher;
+
+  /**
+    Opens the given file and starts prefetching blocks of the given size,
+    keeping up to the given number of blocks ready ahead of the caller.
+  */
+  pub ScanFile (const core::u8string &pathName, size_t blockSize = 1 << 20, size_t blockCount = 4);
+  ScanFile (const ScanFile &) = delete;
+  ScanFile &operator= (const ScanFile &) = delete;
+  pub ~ScanFile () noexcept;
+
+  prv void prefetch ();
+  prv void stop () noexcept;
+  /**
+    Gets the current position in the file.
+  */
+  pub Offset tell () const noexcept;
+  pub size_t read (iu8f *b, size_t s);
+  pub void close ();
+};
+
+static_assert(io::InputStream<ScanFile>);
+
+/**
+  A read-only, memory-mapped view of a file. The contents of the file can be
+  accessed directly (without copying) through views, but an instance is also an
+  {@c InputStream}, so can stand in for a FileStream opened with
+  {@c Mode::readExisting}. The mapping is shared with the file, so if the file
+  is truncated (by anyone) while mapped, accessing the part of the mapped
+  region beyond its new end (through a view or read()) raises {@c SIGBUS}:
+  the file must only grow while it's mapped, or be remapped straight after
+  shrinking and before any further access.
+*/
+class MappedFile {
+  pub typedef FileStream::Size Size;
+  /**
+    Specifies the expected pattern of access to (some part of) the mapping (see
+    {@c madvise}).
+  */
+  pub enum class Advice {
+    normal,
+    sequential,
+    random,
+    willNeed,
+    dontNeed
+  };
+
+  prv int fd;
+  prv const iu8f *data;
+  prv Size size;
+  prv Size position;
+
+  pub explicit MappedFile (const core::u8string &pathName);
+  MappedFile (const MappedFile &) = delete;
+  MappedFile &operator= (const MappedFile &) = delete;
+  pub MappedFile (MappedFile &&) noexcept;
+  pub MappedFile &operator= (MappedFile &&) noexcept;
+  pub ~MappedFile ();
+
+  prv void map ();
+  prv void unmap () noexcept;
+  /**
+    Gets the size of the mapped region i.e. the size of the file when it was
+    last mapped.
+  */
+  pub Size getSize () const noexcept;
+  /**
+    Gets a view of the whole of the mapped region. The view is invalidated by
+    remap() and by close().
+  */
+  pub std::span<const iu8f> view () const noexcept;
+  /**
+    Gets a view of the given part of the mapped region. The view is invalidated
+    by remap() and by close().
+
+    @throw if the given part is not wholly within the mapped region.
+  */
+  pub std::span<const iu8f> view (Size offset, Size s) const;
+  /**
+    Updates the mapped region to cover the whole of the file at its current
+    size (e.g. after it has been grown by a writer), invalidating any existing
+    views. The position is brought back within the region if necessary.
+
+    @return whether the size of the mapped region changed.
+    @throw if the file couldn't be remapped (in which case either the old
+    mapping remains or nothing is mapped and the position is zero).
+  */
+  pub bool remap ();
+  /**
+    Informs the system of the expected pattern of access to the whole of the
+    mapped region.
+  */
+  pub void advise (Advice advice);
+  /**
+    Informs the system of the expected pattern of access to the given part of
+    the mapped region.
+  */
+  pub void advise (Advice advice, Size offset, Size s);
+
+  /**
+    Gets the current position in the file.
+  */
+  pub Size tell () const noexcept;
+  /**
+    Sets the current position in the file.
+  */
+  pub void seek (Size offset);
+  /**
+    Sets the current position in the file to the end.
+  */
+  pub void seekToEnd () noexcept;
+  pub size_t read (iu8f *b, size_t s);
+  /**
+    Gets a view of up to the given number of bytes from the current position
+    in the file and advances the current position past them (like read(), but
+    without copying). At the end of the file, returns an empty view.
+  */
+  pub std::span<const iu8f> readView (size_t s);
   pub void close ();
 };
 
+static_assert(io::InputStream<MappedFile>);
+
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
 }
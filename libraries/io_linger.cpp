@@ -0,0 +1,151 @@
+#include "io_linger.hpp"
+#include <memory>
+#include <sys/socket.h>
+
+namespace io::linger {
+
+using core::PlainException;
+using std::move;
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+using io::event::Reactor;
+using io::socket::Socket;
+using io::socket::TcpSocketStream;
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+DC();
+
+LingeringCloser::LingeringCloser (const Policy &policy) : policy(policy), nextSerial(0), stopping(false), lingeringCount(0) {
+  thread = std::thread([this] () {
+    run();
+  });
+}
+
+LingeringCloser::~LingeringCloser () noexcept {
+  reactor.post([this] () {
+    stopping = true;
+  });
+  thread.join();
+
+  if (!lingering.empty()) {
+    DW(, "closing ", lingering.size(), " sockets without waiting for their peers");
+  }
+  for (auto &i : lingering) {
+    try {
+      reactor.remove(i.first);
+    } catch (PlainException &) {
+      DW(, "failed to stop watching a lingering socket");
+    }
+  }
+  lingering.clear();
+}
+
+void LingeringCloser::run () {
+  while (!stopping) {
+    int timeout = -1;
+    if (!deadlines.empty()) {
+      auto remaining = deadlines.front().time - steady_clock::now();
+      timeout = remaining.count() <= 0 ? 0 : static_cast<int>(duration_cast<milliseconds>(remaining).count() + 1);
+    }
+    reactor.runOnce(timeout);
+
+    auto now = steady_clock::now();
+    while (!deadlines.empty() && deadlines.front().time <= now) {
+      Deadline &deadline = deadlines.front();
+      auto i = lingering.find(deadline.fd);
+      if (i != lingering.end() && i->second.serial == deadline.serial) {
+        DW(, "peer took too long to finish, so closing regardless");
+        finish(deadline.fd);
+      }
+      deadlines.pop_front();
+    }
+  }
+}
+
+void LingeringCloser::adopt (Socket &&socket, steady_clock::time_point deadline) {
+  int fd = socket.getDescriptor();
+  try {
+    reactor.add(fd, EPOLLIN | EPOLLRDHUP, [this, fd] (Reactor::Events) {
+      drain(fd);
+    });
+  } catch (PlainException &) {
+    DW(, "failed to watch a lingering socket, so closing it straight away");
+    --lingeringCount;
+    return;
+  }
+  iu64 serial = nextSerial++;
+  lingering.emplace(fd, Lingering{move(socket), serial, 0});
+  deadlines.push_back(Deadline{deadline, fd, serial});
+}
+
+void LingeringCloser::drain (int fd) {
+  auto i = lingering.find(fd);
+  DA(i != lingering.end());
+  Lingering &l = i->second;
+  try {
+    iu8f dummy[BUFSIZ];
+    while (true) {
+      ssize_t r = l.socket.recv(dummy, sizeof(dummy) / sizeof(*dummy));
+      if (r == -1) {
+        return;
+      }
+      if (r == 0) {
+        DW(, "reached reading stream EOF");
+        break;
+      }
+      l.drainedSize += static_cast<size_t>(r);
+      if (l.drainedSize > policy.maxDrainSize) {
+        DW(, "peer sent too much while closing, so closing regardless");
+        break;
+      }
+    }
+  } catch (PlainException &) {
+    // We made our best effort. Oh, well.
+    DW(, "hit an exception while draining");
+  }
+  finish(fd);
+}
+
+void LingeringCloser::finish (int fd) noexcept {
+  try {
+    reactor.remove(fd);
+  } catch (PlainException &) {
+    DW(, "failed to stop watching a lingering socket");
+  }
+  // (Erasing the entry closes the socket.)
+  lingering.erase(fd);
+  --lingeringCount;
+}
+
+void LingeringCloser::close (TcpSocketStream &&stream) {
+  auto socket = std::make_shared<Socket>(move(stream.getSocket()));
+  if (socket->closed()) {
+    return;
+  }
+
+  DW(, "FINning writing side");
+  try {
+    socket->setNonBlocking(true);
+    socket->shutdown(SHUT_WR);
+  } catch (PlainException &) {
+    DW(, "hit an exception while starting graceful closedown");
+    socket->close();
+    return;
+  }
+
+  ++lingeringCount;
+  auto deadline = steady_clock::now() + policy.timeout;
+  reactor.post([this, socket, deadline] () {
+    adopt(move(*socket), deadline);
+  });
+}
+
+size_t LingeringCloser::getLingeringCount () const noexcept {
+  return lingeringCount;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
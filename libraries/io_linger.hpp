@@ -0,0 +1,101 @@
+/** @file */
+/* -----------------------------------------------------------------------------
+   Lingering Close I/O Library
+   © Geoff Crossland 2017-2022
+----------------------------------------------------------------------------- */
+#ifndef IO_LINGER_ALREADYINCLUDED
+#define IO_LINGER_ALREADYINCLUDED
+
+#include "io_event.hpp"
+#include "io_socket.hpp"
+#include <core.hpp>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+
+namespace io::linger {
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+extern DC();
+
+/**
+  Closes TCP streams gracefully in the background. Like
+  io::socket::TcpSocketStream::close(), it sends FIN for the writing side
+  and then drains the reading side until the peer's FIN before closing the
+  socket (so that unread data doesn't make the system reset the connection,
+  losing whatever of our data the peer hasn't yet received), but the
+  draining is done on the closer's own thread, and is abandoned (closing the
+  socket regardless) once the peer has taken too long or sent too much. All
+  methods may be called from any number of threads.
+*/
+class LingeringCloser {
+  /**
+    Limits on how long a peer can keep a closing connection open.
+  */
+  pub struct Policy {
+    /**
+      How long to wait for the peer's FIN.
+    */
+    std::chrono::steady_clock::duration timeout;
+    /**
+      The most data to discard while waiting for the peer's FIN.
+    */
+    size_t maxDrainSize;
+  };
+
+  prv struct Lingering {
+    io::socket::Socket socket;
+    iu64 serial;
+    size_t drainedSize;
+  };
+  prv struct Deadline {
+    std::chrono::steady_clock::time_point time;
+    int fd;
+    iu64 serial;
+  };
+
+  prv Policy policy;
+  prv io::event::Reactor reactor;
+  prv std::unordered_map<int, Lingering> lingering;
+  /**
+    The deadlines of the lingering sockets, in order (as they all linger for
+    the same time). Those of sockets that have since been closed are skipped.
+  */
+  prv std::deque<Deadline> deadlines;
+  prv iu64 nextSerial;
+  prv bool stopping;
+  prv std::atomic<size_t> lingeringCount;
+  prv std::thread thread;
+
+  pub explicit LingeringCloser (const Policy &policy);
+  LingeringCloser (const LingeringCloser &) = delete;
+  LingeringCloser &operator= (const LingeringCloser &) = delete;
+  /**
+    Closes any sockets that are still lingering straight away.
+  */
+  pub ~LingeringCloser () noexcept;
+
+  prv void run ();
+  prv void adopt (io::socket::Socket &&socket, std::chrono::steady_clock::time_point deadline);
+  prv void drain (int fd);
+  prv void finish (int fd) noexcept;
+  /**
+    Sends FIN for the writing side of the given stream straight away and
+    takes it over, closing it once the peer has sent FIN in return (or has
+    failed to within the policy's limits).
+  */
+  pub void close (io::socket::TcpSocketStream &&stream);
+  /**
+    Gets the number of sockets that have yet to be closed.
+  */
+  pub size_t getLingeringCount () const noexcept;
+};
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
+
+#endif
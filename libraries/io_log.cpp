@@ -0,0 +1,283 @@
+#include "io_log.hpp"
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace io::file { core::u8string createStrerror (int errnum, const char8_t *prefix = u8" (", const char8_t *suffix = u8")"); }
+
+namespace io::log {
+
+using core::u8string;
+using core::PlainException;
+using std::move;
+using std::unique_lock;
+using std::lock_guard;
+using std::chrono::steady_clock;
+using io::file::FileStream;
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+DC();
+
+using io::file::createStrerror;
+
+AppendLog::AppendLog (const u8string &pathName, const Policy &policy) : file(pathName, FileStream::Mode::appendCreate), policy(policy), requested(false), lastSyncDuration(0), stopping(false) {
+  // Make sure that the file itself survives a crash.
+  io::file::flushDirectoryEntryToStorage(pathName);
+  appendedEnd = flushingEnd = durableEnd = file.getSize();
+
+  committer = std::thread([this] () {
+    run();
+  });
+}
+
+AppendLog::~AppendLog () noexcept {
+  stop();
+}
+
+void AppendLog::run () {
+  std::vector<iu8f> writing;
+  unique_lock<std::mutex> l(lock);
+  while (true) {
+    commitRequested.wait(l, [&] () {
+      return requested || stopping;
+    });
+    if (failure) {
+      // The log is unusable, so just wait to be stopped.
+      requested = false;
+      if (stopping) {
+        return;
+      }
+      continue;
+    }
+    if (!requested && pending.empty()) {
+      DA(stopping);
+      return;
+    }
+
+    if (requested && !stopping) {
+      // Gather further commits until the window ends (or until waiting any
+      // longer looks likely to push the earliest commit beyond the latency
+      // cap, or the batch has grown big enough).
+      auto deadline = requestTime + policy.window;
+      auto latestDeadline = requestTime + policy.maxLatency - lastSyncDuration;
+      if (latestDeadline < deadline) {
+        deadline = latestDeadline;
+      }
+      commitRequested.wait_until(l, deadline, [&] () {
+        return stopping || pending.size() >= policy.maxBatchSize;
+      });
+    }
+
+    swap(pending, writing);
+    Position begin = flushingEnd;
+    flushingEnd = appendedEnd;
+    requested = false;
+    l.unlock();
+
+    std::exception_ptr e;
+    auto syncBegin = steady_clock::now();
+    try {
+      file.writeAt(begin, writing.data(), writing.size());
+      file.flushToStorage();
+    } catch (...) {
+      DW(, "failed to commit to log");
+      e = std::current_exception();
+    }
+    auto syncDuration = steady_clock::now() - syncBegin;
+    writing.clear();
+
+    l.lock();
+    if (e) {
+      failure = e;
+    } else {
+      durableEnd = flushingEnd;
+      lastSyncDuration = syncDuration;
+    }
+    committed.notify_all();
+  }
+}
+
+void AppendLog::stop () noexcept {
+  if (!committer.joinable()) {
+    return;
+  }
+
+  {
+    lock_guard<std::mutex> l(lock);
+    stopping = true;
+  }
+  commitRequested.notify_one();
+  committer.join();
+}
+
+AppendLog::Position AppendLog::append (const iu8f *b, size_t s) {
+  lock_guard<std::mutex> l(lock);
+  DPRE(!stopping);
+  pending.insert(pending.end(), b, b + s);
+  appendedEnd += s;
+  return appendedEnd;
+}
+
+void AppendLog::commit (Position end) {
+  unique_lock<std::mutex> l(lock);
+  DPRE(end <= appendedEnd);
+  if (end > flushingEnd && !requested) {
+    requested = true;
+    requestTime = steady_clock::now();
+    commitRequested.notify_one();
+  } else if (pending.size() >= policy.maxBatchSize) {
+    commitRequested.notify_one();
+  }
+
+  committed.wait(l, [&] () {
+    return durableEnd >= end || failure;
+  });
+  if (durableEnd < end) {
+    std::rethrow_exception(failure);
+  }
+}
+
+AppendLog::Position AppendLog::commit (const iu8f *b, size_t s) {
+  Position end = append(b, s);
+  commit(end);
+  return end;
+}
+
+AppendLog::Position AppendLog::getDurableEnd () {
+  lock_guard<std::mutex> l(lock);
+  return durableEnd;
+}
+
+void AppendLog::close () {
+  if (!committer.joinable()) {
+    return;
+  }
+
+  Position end;
+  {
+    lock_guard<std::mutex> l(lock);
+    end = appendedEnd;
+  }
+  commit(end);
+  stop();
+  file.close();
+}
+
+SegmentedLog::SegmentedLog (const u8string &pathNamePrefix, Offset segmentSize, SegmentNumber firstNumber, size_t maxSpareSegmentCount, size_t bufferSize) :
+  pathNamePrefix(pathNamePrefix), segmentSize(segmentSize), maxSpareSegmentCount(maxSpareSegmentCount), bufferSize(bufferSize),
+  oldestNumber(firstNumber), currentNumber(firstNumber), current(openSegment(firstNumber)), currentSize(0)
+{
+  DPRE(segmentSize != 0);
+}
+
+u8string SegmentedLog::getSegmentPathName (SegmentNumber number) const {
+  u8string pathName = pathNamePrefix;
+  for (int i = 60; i >= 0; i -= 4) {
+    pathName.push_back(u8"0123456789abcdef"[(number >> i) & 0xF]);
+  }
+  return pathName;
+}
+
+io::file::FileStream SegmentedLog::openSegment (SegmentNumber number) {
+  u8string pathName = getSegmentPathName(number);
+  // TODO handle path name correctly
+  const char *p = reinterpret_cast<const char *>(pathName.c_str());
+  bool recycled = !spares.empty();
+  if (recycled) {
+    DW(, "recycling segment file ", spares.back().c_str(), " as ", pathName.c_str());
+    if (renameat2(AT_FDCWD, reinterpret_cast<const char *>(spares.back().c_str()), AT_FDCWD, p, RENAME_NOREPLACE) != 0) {
+      throw PlainException(u8string(u8"failed to recycle '") + spares.back() + u8"' as '" + pathName + u8"'" + createStrerror(errno));
+    }
+  } else {
+    DW(, "creating segment file ", pathName.c_str());
+    int fd = ::open(p, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd == -1) {
+      throw PlainException(u8string(u8"failed to create '") + pathName + u8"'" + createStrerror(errno));
+    }
+    int r = fallocate(fd, 0, 0, static_cast<off_t>(segmentSize));
+    if (r != 0 && errno == EOPNOTSUPP) {
+      // Preallocation is just an optimisation, but the segment should have its
+      // full size either way.
+      r = ftruncate(fd, static_cast<off_t>(segmentSize));
+    }
+    int errnum = errno;
+    ::close(fd);
+    if (r != 0) {
+      unlink(p);
+      throw PlainException(u8string(u8"failed to preallocate '") + pathName + u8"'" + createStrerror(errnum));
+    }
+  }
+
+  try {
+    io::file::flushDirectoryEntryToStorage(pathName);
+    io::file::FileStream stream(pathName, io::file::FileStream::Mode::readWriteExisting, bufferSize);
+    if (recycled) {
+      spares.pop_back();
+    }
+    return stream;
+  } catch (...) {
+    // Put things back as they were, so that the segment can be opened again.
+    if (recycled) {
+      rename(p, reinterpret_cast<const char *>(spares.back().c_str()));
+    } else {
+      unlink(p);
+    }
+    throw;
+  }
+}
+
+SegmentedLog::SegmentNumber SegmentedLog::getSegmentNumber () const noexcept {
+  return currentNumber;
+}
+
+SegmentedLog::Offset SegmentedLog::getSegmentSize () const noexcept {
+  return currentSize;
+}
+
+void SegmentedLog::write (const iu8f *b, size_t s) {
+  if (currentSize != 0 && s > segmentSize - currentSize) {
+    roll();
+  }
+  current.write(b, s);
+  currentSize += s;
+}
+
+void SegmentedLog::roll () {
+  // (The current segment stays open until the next one has been, so that a
+  // failure leaves the log as it was.)
+  current.flushToStorage();
+  io::file::FileStream next = openSegment(currentNumber + 1);
+  std::swap(current, next);
+  ++currentNumber;
+  currentSize = 0;
+  next.close();
+}
+
+void SegmentedLog::flush () {
+  current.flush();
+}
+
+void SegmentedLog::flushToStorage () {
+  current.flushToStorage();
+}
+
+void SegmentedLog::retire (SegmentNumber number) {
+  DPRE(number <= currentNumber);
+  for (; oldestNumber < number; ++oldestNumber) {
+    u8string pathName = getSegmentPathName(oldestNumber);
+    if (spares.size() < maxSpareSegmentCount) {
+      spares.push_back(move(pathName));
+    } else if (unlink(reinterpret_cast<const char *>(pathName.c_str())) != 0) {
+      throw PlainException(u8string(u8"failed to delete '") + pathName + u8"'" + createStrerror(errno));
+    }
+  }
+}
+
+void SegmentedLog::close () {
+  current.close();
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
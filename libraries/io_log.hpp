@@ -0,0 +1,207 @@
+/** @file */
+/* -----------------------------------------------------------------------------
+   Log I/O Library
+   © Geoff Crossland 2017-2022
+----------------------------------------------------------------------------- */
+#ifndef IO_LOG_ALREADYINCLUDED
+#define IO_LOG_ALREADYINCLUDED
+
+#include "io_file.hpp"
+#include <core.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace io::log {
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+extern DC();
+
+/**
+  A durable, append-only log file. Data is appended (in memory) by append()
+  and made durable by commit(), which returns only once the data has reached
+  stable storage. Commits are performed by a background thread, which batches
+  concurrent commits together so that a single {@c fdatasync} covers them all
+  (group commit). All methods may be called from any number of threads.
+*/
+class AppendLog {
+  /**
+    A position in the log (the offset of a byte in the file).
+  */
+  pub typedef io::file::RandomAccessFile::Offset Position;
+  /**
+    Controls how commits are batched.
+  */
+  pub struct Policy {
+    /**
+      How long to wait, after a commit has been requested, for others to
+      join the batch before writing it.
+    */
+    std::chrono::microseconds window;
+    /**
+      The amount of uncommitted data at which the batch is written without
+      waiting for the rest of the window.
+    */
+    size_t maxBatchSize;
+    /**
+      The target maximum time between a commit being requested and it
+      completing (so the window is cut short when the previous
+      {@c fdatasync} suggests that waiting for it all would exceed this).
+    */
+    std::chrono::microseconds maxLatency;
+  };
+
+  prv io::file::RandomAccessFile file;
+  prv Policy policy;
+  prv std::mutex lock;
+  prv std::condition_variable commitRequested;
+  prv std::condition_variable committed;
+  prv std::vector<iu8f> pending;
+  prv Position appendedEnd;
+  prv Position flushingEnd;
+  prv Position durableEnd;
+  prv bool requested;
+  prv std::chrono::steady_clock::time_point requestTime;
+  prv std::chrono::steady_clock::duration lastSyncDuration;
+  prv std::exception_ptr failure;
+  prv bool stopping;
+  prv std::thread committer;
+
+  /**
+    Opens (creating if necessary) the given log file, for appending to after
+    any existing contents.
+  */
+  pub AppendLog (const core::u8string &pathName, const Policy &policy);
+  AppendLog (const AppendLog &) = delete;
+  AppendLog &operator= (const AppendLog &) = delete;
+  /**
+    Stops the log, making a best effort to commit any uncommitted data.
+  */
+  pub ~AppendLog () noexcept;
+
+  prv void run ();
+  prv void stop () noexcept;
+  /**
+    Appends the given data to the log (without waiting for it to be written).
+
+    @return the position of the end of the data.
+  */
+  pub Position append (const iu8f *b, size_t s);
+  /**
+    Waits until all data up to the given position has been made durable.
+
+    @throw if the data could not be written or flushed to storage (after
+    which the log can no longer be committed to).
+  */
+  pub void commit (Position end);
+  /**
+    Appends the given data to the log and waits until it has been made
+    durable.
+
+    @return the position of the end of the data.
+  */
+  pub Position commit (const iu8f *b, size_t s);
+  /**
+    Gets the position up to which the log is known to be durable.
+  */
+  pub Position getDurableEnd ();
+  /**
+    Commits all appended data, stops the background thread and closes the
+    file.
+  */
+  pub void close ();
+};
+
+/**
+  An {@c OutputStream} for a log that is split across a sequence of segment
+  files, each named with the log's path name prefix followed by its segment
+  number (in hexadecimal). Each segment is preallocated at its full size
+  before use, so that writing to it doesn't require the filesystem to
+  allocate space, and once the log moves on to a new segment, old segments
+  that are no longer needed (see retire()) are recycled as new ones rather
+  than being deleted and recreated. Note that a recycled segment retains its
+  old contents beyond the point to which it has been written, so readers must
+  be able to recognise where the live data ends (e.g. by a sequence number or
+  checksum in each record) rather than taking everything up to the end of the
+  file. Existing segment files are never overwritten: moving on to a segment
+  number whose file already exists fails.
+*/
+class SegmentedLog {
+  pub typedef iu64 SegmentNumber;
+  pub typedef io::file::RandomAccessFile::Offset Offset;
+
+  prv core::u8string pathNamePrefix;
+  prv Offset segmentSize;
+  prv size_t maxSpareSegmentCount;
+  prv size_t bufferSize;
+  prv SegmentNumber oldestNumber;
+  prv std::vector<core::u8string> spares;
+  prv SegmentNumber currentNumber;
+  prv io::file::FileStream current;
+  prv Offset currentSize;
+
+  /**
+    Starts a log at the given segment number, with segments of the given
+    size, keeping up to the given number of old segments for recycling.
+    Segments are written through a FileStream with a buffer of the given size.
+
+    @throw if the first segment's file already exists (so that restarting a
+    log doesn't wipe it; start at the number after the last one instead).
+  */
+  pub SegmentedLog (const core::u8string &pathNamePrefix, Offset segmentSize, SegmentNumber firstNumber, size_t maxSpareSegmentCount, size_t bufferSize);
+
+  /**
+    Gets the path name of the segment file with the given number.
+  */
+  pub core::u8string getSegmentPathName (SegmentNumber number) const;
+  prv io::file::FileStream openSegment (SegmentNumber number);
+  /**
+    Gets the number of the segment currently being written to.
+  */
+  pub SegmentNumber getSegmentNumber () const noexcept;
+  /**
+    Gets the amount of data written to the current segment.
+  */
+  pub Offset getSegmentSize () const noexcept;
+  /**
+    Writes the given data, moving on to a new segment first if it would not
+    fit in the remainder of the current one (the data is never split across
+    segments).
+  */
+  pub void write (const iu8f *b, size_t s);
+  /**
+    Closes the current segment and moves on to a new one.
+
+    @throw if the new segment couldn't be created (e.g. because its file
+    already exists), in which case the log carries on with the current one.
+  */
+  pub void roll ();
+  /**
+    Passes any buffered data to the system.
+  */
+  pub void flush ();
+  /**
+    Passes any buffered data to the system and waits until it has reached
+    stable storage.
+  */
+  pub void flushToStorage ();
+  /**
+    Indicates that segments before the one with the given number are no
+    longer needed, so they can be kept for recycling (or deleted, if enough
+    are already being kept).
+  */
+  pub void retire (SegmentNumber number);
+  pub void close ();
+};
+
+static_assert(io::OutputStream<SegmentedLog>);
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
+
+#endif
@@ -0,0 +1,215 @@
+#include "io_resolve.hpp"
+
+namespace io::resolve {
+
+using core::u8string;
+using std::move;
+using std::vector;
+using std::unique_lock;
+using std::lock_guard;
+using std::chrono::steady_clock;
+using io::event::Reactor;
+using io::socket::TcpSocketAddress;
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+DC();
+
+Resolver::Resolver (const Policy &policy, size_t threadCount) : policy(policy), stopping(false) {
+  DPRE(policy.maxEntries != 0);
+  DPRE(threadCount != 0);
+  try {
+    for (size_t i = 0; i != threadCount; ++i) {
+      threads.emplace_back([this] () {
+        run();
+      });
+    }
+  } catch (...) {
+    stopThreads();
+    throw;
+  }
+}
+
+Resolver::~Resolver () noexcept {
+  stopThreads();
+}
+
+void Resolver::stopThreads () noexcept {
+  {
+    lock_guard<std::mutex> l(lock);
+    stopping = true;
+  }
+  jobsAvailable.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+}
+
+void Resolver::run () {
+  unique_lock<std::mutex> l(lock);
+  while (true) {
+    jobsAvailable.wait(l, [&] () {
+      return stopping || !jobs.empty();
+    });
+    if (stopping) {
+      return;
+    }
+    u8string nodeName = move(jobs.front());
+    jobs.pop_front();
+    lookUp(l, nodeName);
+  }
+}
+
+void Resolver::getAddrs (vector<TcpSocketAddress> &r_addrs, const Entry &entry, iu16f port) {
+  if (entry.failure) {
+    std::rethrow_exception(entry.failure);
+  }
+  for (const TcpSocketAddress &addr : entry.addrs) {
+    r_addrs.push_back(addr);
+    r_addrs.back().setPort(port);
+  }
+}
+
+void Resolver::makeRoom (steady_clock::time_point now) {
+  for (auto i = entries.begin(); i != entries.end() && entries.size() >= policy.maxEntries;) {
+    if (!i->second.pending && i->second.expiry <= now) {
+      i = entries.erase(i);
+    } else {
+      ++i;
+    }
+  }
+
+  while (entries.size() >= policy.maxEntries) {
+    auto victim = entries.end();
+    for (auto i = entries.begin(); i != entries.end(); ++i) {
+      if (!i->second.pending && (victim == entries.end() || i->second.expiry < victim->second.expiry)) {
+        victim = i;
+      }
+    }
+    if (victim == entries.end()) {
+      // (Entries being resolved are never discarded.)
+      break;
+    }
+    DW(, "discarding the cached resolution of '", victim->first, "'");
+    entries.erase(victim);
+  }
+}
+
+Resolver::Entry *Resolver::find (const u8string &nodeName, steady_clock::time_point now) {
+  auto i = entries.find(nodeName);
+  if (i == entries.end()) {
+    return nullptr;
+  }
+  if (!i->second.pending && i->second.expiry <= now) {
+    entries.erase(i);
+    return nullptr;
+  }
+  return &i->second;
+}
+
+void Resolver::lookUp (unique_lock<std::mutex> &l, const u8string &nodeName) {
+  vector<TcpSocketAddress> addrs;
+  std::exception_ptr failure;
+  l.unlock();
+  try {
+    TcpSocketAddress::get(addrs, nodeName, 0);
+  } catch (...) {
+    failure = std::current_exception();
+  }
+  l.lock();
+
+  // (Pending entries are never discarded, so it's still there.)
+  Entry &entry = entries.at(nodeName);
+  entry.addrs = move(addrs);
+  entry.failure = failure;
+  entry.expiry = steady_clock::now() + (failure ? policy.negativeTtl : policy.ttl);
+  entry.pending = false;
+  for (auto &waiter : entry.waiters) {
+    waiter(entry);
+  }
+  entry.waiters.clear();
+  resolutionsFinished.notify_all();
+}
+
+void Resolver::get (vector<TcpSocketAddress> &r_addrs, const u8string &nodeName, iu16f port) {
+  unique_lock<std::mutex> l(lock);
+  while (true) {
+    auto now = steady_clock::now();
+    Entry *entry = find(nodeName, now);
+    if (!entry) {
+      makeRoom(now);
+      entries[nodeName].pending = true;
+      lookUp(l, nodeName);
+      break;
+    }
+    if (!entry->pending) {
+      break;
+    }
+    // Wait for the resolution in progress rather than make another.
+    resolutionsFinished.wait(l);
+  }
+  getAddrs(r_addrs, entries.at(nodeName), port);
+}
+
+void Resolver::resolve (const u8string &nodeName, std::function<void (const Entry &)> &&waiter) {
+  lock_guard<std::mutex> l(lock);
+  auto now = steady_clock::now();
+  Entry *entry = find(nodeName, now);
+  if (entry && !entry->pending) {
+    waiter(*entry);
+    return;
+  }
+  if (!entry) {
+    makeRoom(now);
+    entry = &entries[nodeName];
+    entry->pending = true;
+    jobs.push_back(nodeName);
+    jobsAvailable.notify_one();
+  }
+  entry->waiters.push_back(move(waiter));
+}
+
+std::future<vector<TcpSocketAddress>> Resolver::resolve (const u8string &nodeName, iu16f port) {
+  auto promise = std::make_shared<std::promise<vector<TcpSocketAddress>>>();
+  std::future<vector<TcpSocketAddress>> future = promise->get_future();
+  resolve(nodeName, [promise, port] (const Entry &entry) {
+    try {
+      vector<TcpSocketAddress> addrs;
+      getAddrs(addrs, entry, port);
+      promise->set_value(move(addrs));
+    } catch (...) {
+      promise->set_exception(std::current_exception());
+    }
+  });
+  return future;
+}
+
+void Resolver::resolve (const u8string &nodeName, iu16f port, Reactor &reactor, Callback &&callback) {
+  resolve(nodeName, [&reactor, callback = move(callback), port] (const Entry &entry) {
+    vector<TcpSocketAddress> addrs;
+    if (!entry.failure) {
+      getAddrs(addrs, entry, port);
+    }
+    reactor.post([callback, addrs = move(addrs), failure = entry.failure] () mutable {
+      callback(move(addrs), failure);
+    });
+  });
+}
+
+void Resolver::forget (const u8string &nodeName) {
+  lock_guard<std::mutex> l(lock);
+  auto i = entries.find(nodeName);
+  if (i != entries.end() && !i->second.pending) {
+    entries.erase(i);
+  }
+}
+
+size_t Resolver::getEntryCount () {
+  lock_guard<std::mutex> l(lock);
+  return entries.size();
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
@@ -0,0 +1,145 @@
+/** @file */
+/* -----------------------------------------------------------------------------
+   Resolution I/O Library
+   © Geoff Crossland 2017-2022
+----------------------------------------------------------------------------- */
+#ifndef IO_RESOLVE_ALREADYINCLUDED
+#define IO_RESOLVE_ALREADYINCLUDED
+
+#include "io_event.hpp"
+#include "io_socket.hpp"
+#include <core.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace io::resolve {
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+extern DC();
+
+/**
+  Resolves node names (as for io::socket::TcpSocketAddress::get()) and
+  caches the results, so that names that are looked up repeatedly (such as
+  those of backends that are reconnected to) don't each cost a
+  {@c getaddrinfo} call. Failures are cached too (for a shorter time), and
+  concurrent lookups of the same name share a single {@c getaddrinfo} call.
+  Lookups can be made synchronously with get() or asynchronously (on the
+  resolver's own threads) with resolve(). All methods may be called from any
+  number of threads.
+*/
+class Resolver {
+  /**
+    Controls how long results are cached for.
+  */
+  pub struct Policy {
+    /**
+      How long a successful resolution is cached.
+    */
+    std::chrono::steady_clock::duration ttl;
+    /**
+      How long a failed resolution is cached.
+    */
+    std::chrono::steady_clock::duration negativeTtl;
+    /**
+      The most names cached (beyond which the entry closest to expiry is
+      discarded).
+    */
+    size_t maxEntries;
+  };
+  /**
+    Receives the outcome of an asynchronous resolution: either the addresses
+    or the exception that the resolution failed with.
+  */
+  pub typedef std::function<void (std::vector<io::socket::TcpSocketAddress> &&addrs, std::exception_ptr failure)> Callback;
+
+  prv struct Entry {
+    /**
+      The resolved addresses (with a port of zero).
+    */
+    std::vector<io::socket::TcpSocketAddress> addrs;
+    std::exception_ptr failure;
+    std::chrono::steady_clock::time_point expiry;
+    /**
+      Whether the name is being resolved (in which case the entry has no
+      result yet).
+    */
+    bool pending;
+    /**
+      Functions to call (with the lock held) once the name has been resolved.
+    */
+    std::vector<std::function<void (const Entry &)>> waiters;
+  };
+
+  prv Policy policy;
+  prv std::mutex lock;
+  prv std::condition_variable resolutionsFinished;
+  prv std::condition_variable jobsAvailable;
+  prv std::map<core::u8string, Entry> entries;
+  prv std::deque<core::u8string> jobs;
+  prv bool stopping;
+  prv std::vector<std::thread> threads;
+
+  /**
+    Creates an empty cache with the given policy and the given number (which
+    must be non-zero) of threads for resolve().
+  */
+  pub Resolver (const Policy &policy, size_t threadCount);
+  Resolver (const Resolver &) = delete;
+  Resolver &operator= (const Resolver &) = delete;
+  /**
+    Abandons any outstanding asynchronous resolutions (whose futures then
+    report a broken promise, and whose callbacks are never called).
+  */
+  pub ~Resolver () noexcept;
+
+  prv void stopThreads () noexcept;
+  prv void run ();
+  prv static void getAddrs (std::vector<io::socket::TcpSocketAddress> &r_addrs, const Entry &entry, iu16f port);
+  prv void makeRoom (std::chrono::steady_clock::time_point now);
+  prv Entry *find (const core::u8string &nodeName, std::chrono::steady_clock::time_point now);
+  prv void lookUp (std::unique_lock<std::mutex> &l, const core::u8string &nodeName);
+  prv void resolve (const core::u8string &nodeName, std::function<void (const Entry &)> &&waiter);
+  /**
+    Gets a sequence of TcpSocketAddress objects that each identify the given
+    port on the given node (as for io::socket::TcpSocketAddress::get()), from
+    the cache if possible, resolving the name on this thread if not.
+
+    @throw if the name couldn't be resolved (or failed to resolve recently).
+  */
+  pub void get (std::vector<io::socket::TcpSocketAddress> &r_addrs, const core::u8string &nodeName, iu16f port);
+  /**
+    Resolves the given node name (from the cache if possible) as for get(),
+    on one of the resolver's threads.
+
+    @return a future that receives the addresses or the exception that the
+    resolution failed with.
+  */
+  pub std::future<std::vector<io::socket::TcpSocketAddress>> resolve (const core::u8string &nodeName, iu16f port);
+  /**
+    Resolves the given node name (from the cache if possible) as for get(),
+    on one of the resolver's threads, and then has the given callback called
+    on the thread running the given reactor (even if the result was cached).
+  */
+  pub void resolve (const core::u8string &nodeName, iu16f port, io::event::Reactor &reactor, Callback &&callback);
+  /**
+    Discards any cached result for the given node name (e.g. once a
+    connection to one of its addresses has failed).
+  */
+  pub void forget (const core::u8string &nodeName);
+  pub size_t getEntryCount ();
+};
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
+
+#endif
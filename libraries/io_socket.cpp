@@ -3,6 +3,14 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <linux/errqueue.h>
+#include <linux/sockios.h>
 
 namespace io::file { core::u8string createStrerror (int errnum, const char8_t *prefix = u8" (", const char8_t *suffix = u8")"); }
 
@@ -14,6 +22,7 @@ using std::vector;
 using core::PlainException;
 using std::move;
 using std::get;
+using std::optional;
 using core::unsign;
 using core::numeric_limits;
 
@@ -67,12 +76,35 @@ TcpSocketAddress::TcpSocketAddress (const sockaddr_in6 &socketAddr6) {
   DW(, "made TcpSocketAddress - IPv6 ", rep.c_str());
 }
 
+optional<TcpSocketAddress> TcpSocketAddress::get (const sockaddr_storage &socketAddr) noexcept {
+  switch (socketAddr.ss_family) {
+    case AF_INET:
+      return optional<TcpSocketAddress>(TcpSocketAddress(*reinterpret_cast<const sockaddr_in *>(&socketAddr)));
+    case AF_INET6:
+      return optional<TcpSocketAddress>(TcpSocketAddress(*reinterpret_cast<const sockaddr_in6 *>(&socketAddr)));
+    default:
+      return optional<TcpSocketAddress>();
+  }
+}
+
 sa_family_t TcpSocketAddress::getFamily () const noexcept {
   DA(static_cast<const void *>(&_) == static_cast<const void *>(&_.socketAddr4));
   DA(static_cast<const void *>(&_) == static_cast<const void *>(&_.socketAddr6));
   return reinterpret_cast<const sockaddr *>(&_)->sa_family;
 }
 
+iu16f TcpSocketAddress::getPort () const noexcept {
+  return ntohs(getFamily() == AF_INET ? _.socketAddr4.sin_port : _.socketAddr6.sin6_port);
+}
+
+void TcpSocketAddress::setPort (iu16f port) noexcept {
+  if (getFamily() == AF_INET) {
+    _.socketAddr4.sin_port = htons(port);
+  } else {
+    _.socketAddr6.sin6_port = htons(port);
+  }
+}
+
 tuple<const sockaddr *, socklen_t> TcpSocketAddress::getSocketAddress () const noexcept {
   return tuple<const sockaddr *, socklen_t>(reinterpret_cast<const sockaddr *>(&_), getFamily() == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6));
 }
@@ -144,35 +176,26 @@ void TcpSocketAddress::get (vector<TcpSocketAddress> &r_addrs, const char8_t *no
     freeaddrinfo(addrs);
   });
 
-  DW(, "resolution got:");
   for (addrinfo *i = addrs; i; i = i->ai_next) {
-    DW(, "  entry:");
-    DW(, "    family ", i->ai_family);
-    DW(, "    socktype ", i->ai_socktype);
-    DW(, "    protocol ", i->ai_protocol);
-    DW(, "    addrlen ", i->ai_addrlen);
     if (i->ai_socktype != TcpSocketAddress::type || i->ai_protocol != TcpSocketAddress::protocol) {
       continue;
     }
-    DW(, "    is tcp (and stream)");
 
     switch (i->ai_family) {
       case AF_INET: {
-        DW(, "    is ipv4");
         sockaddr_in &socketAddr = *reinterpret_cast<sockaddr_in *>(i->ai_addr);
         DA(i->ai_addrlen == sizeof(socketAddr));
         socketAddr.sin_port = htons(port);
         r_addrs.push_back(TcpSocketAddress(socketAddr));
       } break;
       case AF_INET6: {
-        DW(, "    is ipv6");
         sockaddr_in6 &socketAddr = *reinterpret_cast<sockaddr_in6 *>(i->ai_addr);
         DA(i->ai_addrlen == sizeof(socketAddr));
         socketAddr.sin6_port = htons(port);
         r_addrs.push_back(TcpSocketAddress(socketAddr));
       } break;
       default:
-        DW(, "    not ip");
+        DW(, "  skipping non-IP entry of family ", i->ai_family);
         break;
     }
   }
@@ -207,6 +230,49 @@ void TcpSocketAddress::get (vector<TcpSocketAddress> &r_addrs, iu16f port) {
   get(r_addrs, nullptr, port);
 }
 
+UnixSocketAddress::UnixSocketAddress (const u8string &name, bool abstract) {
+  std::memset(&socketAddr, 0, sizeof(socketAddr));
+  socketAddr.sun_family = AF_UNIX;
+  // (An abstract name is marked by a leading NUL and needs no terminator.)
+  size_t offset = abstract ? 1 : 0;
+  size_t maxNameSize = sizeof(socketAddr.sun_path) - 1;
+  if (name.empty() || name.size() > maxNameSize || (!abstract && name.find(u8'\0') != u8string::npos)) {
+    throw PlainException(u8string(u8"'") + name + u8"' is not a valid Unix-domain socket address");
+  }
+  std::memcpy(socketAddr.sun_path + offset, name.data(), name.size());
+  socketAddrSize = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + offset + name.size() + (abstract ? 0 : 1));
+}
+
+sa_family_t UnixSocketAddress::getFamily () const noexcept {
+  return AF_UNIX;
+}
+
+bool UnixSocketAddress::isAbstract () const noexcept {
+  return socketAddr.sun_path[0] == '\0';
+}
+
+tuple<const sockaddr *, socklen_t> UnixSocketAddress::getSocketAddress () const noexcept {
+  return tuple<const sockaddr *, socklen_t>(reinterpret_cast<const sockaddr *>(&socketAddr), socketAddrSize);
+}
+
+void UnixSocketAddress::getSocketAddress (u8string &r_r) const noexcept {
+  const char8_t *name = reinterpret_cast<const char8_t *>(socketAddr.sun_path);
+  size_t nameSize = socketAddrSize - offsetof(sockaddr_un, sun_path);
+  if (isAbstract()) {
+    r_r.append(u8"@");
+    r_r.append(name + 1, nameSize - 1);
+  } else {
+    r_r.append(name, nameSize - 1);
+  }
+}
+
+bool wouldHaveBlocked () noexcept {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+Socket::Socket () noexcept : s(-1) {
+}
+
 Socket::Socket (decltype(s) s) : s(s) {
   DPRE(s != -1);
 }
@@ -218,7 +284,10 @@ Socket::Socket (sa_family_t family, int type, int protocol) {
   }
 }
 
-Socket::Socket (const TcpSocketAddress &addr) : Socket(addr.getFamily(), TcpSocketAddress::type, TcpSocketAddress::protocol) {
+Socket::Socket (const TcpSocketAddress &addr) : Socket(addr.getFamily(), TcpSocketAddress::type | SOCK_CLOEXEC, TcpSocketAddress::protocol) {
+}
+
+Socket::Socket (const UnixSocketAddress &addr) : Socket(addr.getFamily(), UnixSocketAddress::type | SOCK_CLOEXEC, UnixSocketAddress::protocol) {
 }
 
 Socket::Socket (Socket &&o) noexcept : s(-1) {
@@ -242,8 +311,15 @@ Socket::~Socket () noexcept {
   }
 }
 
-void Socket::bind (const TcpSocketAddress &addr) {
-  DPRE(s != -1);
+tuple<Socket, Socket> Socket::createPair () {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
+    throw PlainException(u8string(u8"failed to create a pair of network sockets") + createStrerror(errno));
+  }
+  return tuple<Socket, Socket>(Socket(fds[0]), Socket(fds[1]));
+}
+
+template<typename _Address> void bindSocket (int s, const _Address &addr) {
   tuple<const sockaddr *, socklen_t> o = addr.getSocketAddress();
   int r = ::bind(s, get<0>(o), get<1>(o));
   if (r == -1) {
@@ -253,6 +329,16 @@ void Socket::bind (const TcpSocketAddress &addr) {
   }
 }
 
+void Socket::bind (const TcpSocketAddress &addr) {
+  DPRE(s != -1);
+  bindSocket(s, addr);
+}
+
+void Socket::bind (const UnixSocketAddress &addr) {
+  DPRE(s != -1);
+  bindSocket(s, addr);
+}
+
 void Socket::listen (iu listenBacklog) {
   DPRE(s != -1);
   auto maxListenBacklog = unsign(numeric_limits<int>::max());
@@ -268,15 +354,33 @@ void Socket::listen (iu listenBacklog) {
 
 Socket Socket::accept () {
   DPRE(s != -1);
-  decltype(s) s0 = ::accept(s, nullptr, 0);
+  decltype(s) s0 = ::accept4(s, nullptr, nullptr, SOCK_CLOEXEC);
   if (s0 == -1) {
+    if (wouldHaveBlocked()) {
+      return Socket();
+    }
     throw PlainException(u8string(u8"failed to accept connections to a listening network socket") + createStrerror(errno));
   }
   return Socket(s0);
 }
 
-void Socket::connect (const TcpSocketAddress &addr) {
+Socket Socket::accept (int flags, optional<TcpSocketAddress> &r_peerAddr) {
   DPRE(s != -1);
+  DPRE((flags & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) == 0);
+  sockaddr_storage peerAddr;
+  socklen_t peerAddrSize = sizeof(peerAddr);
+  decltype(s) s0 = ::accept4(s, reinterpret_cast<sockaddr *>(&peerAddr), &peerAddrSize, flags);
+  if (s0 == -1) {
+    if (wouldHaveBlocked()) {
+      return Socket();
+    }
+    throw PlainException(u8string(u8"failed to accept connections to a listening network socket") + createStrerror(errno));
+  }
+  r_peerAddr = TcpSocketAddress::get(peerAddr);
+  return Socket(s0);
+}
+
+template<typename _Address> void connectSocket (int s, const _Address &addr) {
   tuple<const sockaddr *, socklen_t> o = addr.getSocketAddress();
   int r = ::connect(s, get<0>(o), get<1>(o));
   if (r == -1) {
@@ -286,36 +390,310 @@ void Socket::connect (const TcpSocketAddress &addr) {
   }
 }
 
+void Socket::connect (const TcpSocketAddress &addr) {
+  DPRE(s != -1);
+  connectSocket(s, addr);
+}
+
+void Socket::connect (const UnixSocketAddress &addr) {
+  DPRE(s != -1);
+  connectSocket(s, addr);
+}
+
+bool Socket::startConnect (const TcpSocketAddress &addr) {
+  DPRE(s != -1);
+  tuple<const sockaddr *, socklen_t> o = addr.getSocketAddress();
+  if (::connect(s, get<0>(o), get<1>(o)) == 0) {
+    return true;
+  }
+  // (An interrupted connect carries on asynchronously.)
+  if (errno == EINPROGRESS || errno == EINTR) {
+    return false;
+  }
+  u8string msg = u8"failed to connect a network socket to ";
+  addr.getSocketAddress(msg);
+  throw PlainException(move(msg) + createStrerror(errno));
+}
+
+int Socket::getError () {
+  DPRE(s != -1);
+  int errnum;
+  socklen_t errnumSize = sizeof(errnum);
+  if (getsockopt(s, SOL_SOCKET, SO_ERROR, &errnum, &errnumSize) == -1) {
+    throw PlainException(u8string(u8"failed to get the error of a network socket") + createStrerror(errno));
+  }
+  return errnum;
+}
+
 void Socket::setOptions (bool keepalive) {
+  SocketOptions options;
+  options.noDelay = true;
+  options.keepalive = keepalive;
+  setOptions(options);
+}
+
+template<typename _T> void setOption (int s, int level, int name, const _T &optval, const char8_t *description) {
+  if (setsockopt(s, level, name, &optval, sizeof(optval)) == -1) {
+    throw PlainException(u8string(u8"failed to set the ") + description + u8" of a network socket" + createStrerror(errno));
+  }
+}
+
+void Socket::setOptions (const SocketOptions &options) {
+  DPRE(s != -1);
+  if (options.noDelay) {
+    setOption(s, IPPROTO_TCP, TCP_NODELAY, static_cast<int>(*options.noDelay), u8"Nagle mode");
+  }
+  if (options.keepalive) {
+    setOption(s, SOL_SOCKET, SO_KEEPALIVE, static_cast<int>(*options.keepalive), u8"keepalive mode");
+  }
+  if (options.sendBufferSize) {
+    setOption(s, SOL_SOCKET, SO_SNDBUF, *options.sendBufferSize, u8"send buffer size");
+  }
+  if (options.receiveBufferSize) {
+    setOption(s, SOL_SOCKET, SO_RCVBUF, *options.receiveBufferSize, u8"receive buffer size");
+  }
+  if (options.quickAck) {
+    setOption(s, IPPROTO_TCP, TCP_QUICKACK, static_cast<int>(*options.quickAck), u8"quick acknowledgement mode");
+  }
+  if (options.notSentLowWatermark) {
+    setOption(s, IPPROTO_TCP, TCP_NOTSENT_LOWAT, static_cast<unsigned>(*options.notSentLowWatermark), u8"unsent data low watermark");
+  }
+  if (options.busyPoll) {
+    setOption(s, SOL_SOCKET, SO_BUSY_POLL, static_cast<int>(options.busyPoll->count()), u8"busy polling time");
+  }
+  if (options.userTimeout) {
+    setOption(s, IPPROTO_TCP, TCP_USER_TIMEOUT, static_cast<unsigned>(options.userTimeout->count()), u8"user timeout");
+  }
+  if (options.congestionControl) {
+    const u8string &name = *options.congestionControl;
+    if (setsockopt(s, IPPROTO_TCP, TCP_CONGESTION, name.data(), static_cast<socklen_t>(name.size())) == -1) {
+      throw PlainException(u8string(u8"failed to set the congestion control algorithm of a network socket to '") + name + u8"'" + createStrerror(errno));
+    }
+  }
+}
+
+TcpInfo Socket::getTcpInfo () const {
+  DPRE(s != -1);
+  tcp_info info;
+  socklen_t infoSize = sizeof(info);
+  int outSize;
+  int unsentSize;
+  if (
+    getsockopt(s, IPPROTO_TCP, TCP_INFO, &info, &infoSize) == -1 ||
+    ioctl(s, SIOCOUTQ, &outSize) == -1 ||
+    ioctl(s, SIOCOUTQNSD, &unsentSize) == -1
+  ) {
+    throw PlainException(u8string(u8"failed to get the state of a network socket") + createStrerror(errno));
+  }
+
+  TcpInfo r;
+  r.state = info.tcpi_state;
+  r.rtt = std::chrono::microseconds(info.tcpi_rtt);
+  r.rttVariance = std::chrono::microseconds(info.tcpi_rttvar);
+  r.retransmitTimeout = std::chrono::microseconds(info.tcpi_rto);
+  r.congestionWindow = info.tcpi_snd_cwnd;
+  r.slowStartThreshold = info.tcpi_snd_ssthresh;
+  r.sendMss = info.tcpi_snd_mss;
+  r.unackedSegments = info.tcpi_unacked;
+  r.lostSegments = info.tcpi_lost;
+  r.retransmittingSegments = info.tcpi_retrans;
+  r.totalRetransmits = info.tcpi_total_retrans;
+  // (The send queue holds both the unacknowledged and the unsent data.)
+  r.unackedSize = outSize > unsentSize ? unsign(outSize - unsentSize) : 0;
+  r.unsentSize = unsign(unsentSize);
+  return r;
+}
+
+void Socket::setReusePort () {
   DPRE(s != -1);
-  {
-    int optval = 1;
-    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+  int optval = 1;
+  if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
+    throw PlainException(u8string(u8"failed to let a network socket share its port") + createStrerror(errno));
   }
-  {
-    int optval = keepalive;
-    setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(optval));
+}
+
+void Socket::setIncomingCpu (int cpu) {
+  DPRE(s != -1);
+  if (setsockopt(s, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1) {
+    throw PlainException(u8string(u8"failed to associate a network socket with a CPU") + createStrerror(errno));
   }
 }
 
+void Socket::setNonBlocking (bool nonBlocking) {
+  DPRE(s != -1);
+  int flags = fcntl(s, F_GETFL);
+  if (flags == -1 || fcntl(s, F_SETFL, nonBlocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) == -1) {
+    throw PlainException(u8string(u8"failed to set the blocking mode of a network socket") + createStrerror(errno));
+  }
+}
+
+ssize_t checkTransfer (io::Result r) {
+  if (r.wouldBlock()) {
+    return -1;
+  }
+  return static_cast<ssize_t>(r.check());
+}
+
 ssize_t Socket::recv (void *buf, size_t len) {
+  return checkTransfer(tryRecv(buf, len));
+}
+
+ssize_t Socket::send (const void *buf, size_t len) {
+  return checkTransfer(trySend(buf, len));
+}
+
+ssize_t Socket::recv (const iovec *v, size_t vSize) {
+  return checkTransfer(tryRecv(v, vSize));
+}
+
+ssize_t Socket::send (const iovec *v, size_t vSize) {
+  return send(v, vSize, 0);
+}
+
+ssize_t Socket::send (const iovec *v, size_t vSize, int flags) {
+  return checkTransfer(trySend(v, vSize, flags));
+}
+
+io::Result Socket::tryRecv (void *buf, size_t len) noexcept {
   DPRE(s != -1);
   ssize_t r = ::recv(s, buf, len, 0);
   if (r == -1) {
-    throw PlainException(u8string(u8"failed to read from a network socket") + createStrerror(errno));
+    return io::Result::ofError(errno, u8"failed to read from a network socket");
+  }
+  return io::Result::ofSize(static_cast<size_t>(r));
+}
+
+io::Result Socket::trySend (const void *buf, size_t len) noexcept {
+  DPRE(s != -1);
+  ssize_t r = ::send(s, buf, len, MSG_NOSIGNAL);
+  if (r == -1) {
+    return io::Result::ofError(errno, u8"failed to write to a network socket");
+  }
+  return io::Result::ofSize(static_cast<size_t>(r));
+}
+
+msghdr EMPTY_MSGHDR;
+
+io::Result Socket::tryRecv (const iovec *v, size_t vSize) noexcept {
+  DPRE(s != -1);
+  msghdr m = EMPTY_MSGHDR;
+  m.msg_iov = const_cast<iovec *>(v);
+  m.msg_iovlen = vSize < IOV_MAX ? vSize : IOV_MAX;
+  ssize_t r = ::recvmsg(s, &m, 0);
+  if (r == -1) {
+    return io::Result::ofError(errno, u8"failed to read from a network socket");
+  }
+  return io::Result::ofSize(static_cast<size_t>(r));
+}
+
+io::Result Socket::trySend (const iovec *v, size_t vSize, int flags) noexcept {
+  DPRE(s != -1);
+  msghdr m = EMPTY_MSGHDR;
+  m.msg_iov = const_cast<iovec *>(v);
+  m.msg_iovlen = vSize < IOV_MAX ? vSize : IOV_MAX;
+  ssize_t r = ::sendmsg(s, &m, flags | MSG_NOSIGNAL);
+  if (r == -1) {
+    return io::Result::ofError(errno, u8"failed to write to a network socket");
+  }
+  return io::Result::ofSize(static_cast<size_t>(r));
+}
+
+ssize_t Socket::sendDescriptors (const iovec *v, size_t vSize, const int *fds, size_t fdsSize) {
+  DPRE(s != -1);
+  DPRE(io::getSize(v, vSize) != 0);
+  size_t controlSize = CMSG_SPACE(sizeof(int) * fdsSize);
+  std::unique_ptr<char[]> control(new char[controlSize]());
+  msghdr m = EMPTY_MSGHDR;
+  m.msg_iov = const_cast<iovec *>(v);
+  m.msg_iovlen = vSize < IOV_MAX ? vSize : IOV_MAX;
+  if (fdsSize != 0) {
+    m.msg_control = control.get();
+    m.msg_controllen = controlSize;
+    cmsghdr *c = CMSG_FIRSTHDR(&m);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * fdsSize);
+    std::memcpy(CMSG_DATA(c), fds, sizeof(int) * fdsSize);
+  }
+  ssize_t r = ::sendmsg(s, &m, MSG_NOSIGNAL);
+  if (r == -1) {
+    if (wouldHaveBlocked()) {
+      return -1;
+    }
+    throw PlainException(u8string(u8"failed to write file descriptors to a network socket") + createStrerror(errno));
   }
   return r;
 }
 
-ssize_t Socket::send (const void *buf, size_t len) {
+ssize_t Socket::recvDescriptors (const iovec *v, size_t vSize, vector<int> &r_fds, size_t maxFdsSize, bool &r_truncated) {
   DPRE(s != -1);
-  ssize_t r = ::send(s, buf, len, 0);
+  r_truncated = false;
+  size_t controlSize = CMSG_SPACE(sizeof(int) * maxFdsSize);
+  std::unique_ptr<char[]> control(new char[controlSize]());
+  msghdr m = EMPTY_MSGHDR;
+  m.msg_iov = const_cast<iovec *>(v);
+  m.msg_iovlen = vSize < IOV_MAX ? vSize : IOV_MAX;
+  m.msg_control = control.get();
+  m.msg_controllen = controlSize;
+  ssize_t r = ::recvmsg(s, &m, MSG_CMSG_CLOEXEC);
   if (r == -1) {
-    throw PlainException(u8string(u8"failed to write to a network socket") + createStrerror(errno));
+    if (wouldHaveBlocked()) {
+      return -1;
+    }
+    throw PlainException(u8string(u8"failed to read file descriptors from a network socket") + createStrerror(errno));
+  }
+
+  size_t rFdsSize0 = r_fds.size();
+  for (cmsghdr *c = CMSG_FIRSTHDR(&m); c; c = CMSG_NXTHDR(&m, c)) {
+    if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    size_t fdsSize = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    const unsigned char *data = CMSG_DATA(c);
+    for (size_t i = 0; i != fdsSize; ++i) {
+      int fd;
+      std::memcpy(&fd, data + i * sizeof(int), sizeof(int));
+      r_fds.push_back(fd);
+    }
+  }
+  if (m.msg_flags & MSG_CTRUNC) {
+    DW(, "received more file descriptors than there was room for; closing them");
+    for (size_t i = rFdsSize0; i != r_fds.size(); ++i) {
+      ::close(r_fds[i]);
+    }
+    r_fds.resize(rFdsSize0);
+    r_truncated = true;
   }
   return r;
 }
 
+void Socket::setCork (bool corked) {
+  DPRE(s != -1);
+  int optval = corked;
+  if (setsockopt(s, IPPROTO_TCP, TCP_CORK, &optval, sizeof(optval)) == -1) {
+    throw PlainException(u8string(corked ? u8"failed to cork a network socket" : u8"failed to uncork a network socket") + createStrerror(errno));
+  }
+}
+
+void Socket::wait (short events) {
+  tryWait(events).check();
+}
+
+io::Result Socket::tryWait (short events) noexcept {
+  DPRE(s != -1);
+  pollfd p;
+  p.fd = s;
+  p.events = events;
+  int r;
+  do {
+    r = poll(&p, 1, -1);
+  } while (r == -1 && errno == EINTR);
+  if (r == -1) {
+    return io::Result::ofError(errno, u8"failed to wait for a network socket");
+  }
+  return io::Result::ofSize(0);
+}
+
 void Socket::shutdown (int how) {
   DPRE(s != -1);
   ::shutdown(s, how);
@@ -337,24 +715,42 @@ bool Socket::closed () const noexcept {
   return s == -1;
 }
 
-TcpSocketStream::TcpSocketStream (Socket &&socket) : socket(move(socket)) {
+int Socket::getDescriptor () const noexcept {
+  return s;
+}
+
+SocketStream::SocketStream (Socket &&socket) : socket(move(socket)) {
 }
 
-TcpSocketStream::TcpSocketStream (const TcpSocketAddress &targetAddr, bool keepalive) : socket(targetAddr) {
+SocketStream::SocketStream (const TcpSocketAddress &targetAddr, bool keepalive) : socket(targetAddr) {
   socket.connect(targetAddr);
   socket.setOptions(keepalive);
 }
 
-size_t TcpSocketStream::read (iu8f *b, size_t s) {
-  DPRE(s < numeric_limits<size_t>::max());
+SocketStream::SocketStream (const UnixSocketAddress &targetAddr) : socket(targetAddr) {
+  socket.connect(targetAddr);
+}
+
+tuple<SocketStream, SocketStream> SocketStream::createPair () {
+  auto [s0, s1] = Socket::createPair();
+  return tuple<SocketStream, SocketStream>(SocketStream(move(s0)), SocketStream(move(s1)));
+}
+
+Socket &SocketStream::getSocket () noexcept {
+  return socket;
+}
+
+size_t SocketStream::read (iu8f *b, size_t s) {
+  DPRE(s < wouldBlock);
   if (s == 0) {
     return 0;
   }
 
-  ssize_t outSize_ = socket.recv(b, s);
-  DA(outSize_ >= 0);
-  auto outSize = static_cast<size_t>(outSize_);
-  DA(outSize <= s);
+  io::Result r = tryRead(b, s);
+  if (r.wouldBlock()) {
+    return wouldBlock;
+  }
+  size_t outSize = r.check();
   if (outSize == 0) {
     return numeric_limits<size_t>::max();
   }
@@ -362,25 +758,100 @@ size_t TcpSocketStream::read (iu8f *b, size_t s) {
   return outSize;
 }
 
-void TcpSocketStream::write (const iu8f *b, size_t s) {
+void SocketStream::write (const iu8f *b, size_t s) {
+  tryWrite(b, s).check();
+}
+
+io::Result SocketStream::tryRead (iu8f *b, size_t s) noexcept {
+  if (s == 0) {
+    return io::Result::ofError(EINVAL, u8"failed to read from a network socket");
+  }
+  io::Result r = socket.tryRecv(b, s);
+  DA(!r.succeeded() || r.getSize() <= s);
+  return r;
+}
+
+io::Result SocketStream::tryWrite (const iu8f *b, size_t s) noexcept {
+  size_t size = s;
   while (s != 0) {
-    ssize_t outSize_ = socket.send(b, s);
-    DA(outSize_ >= 0);
-    auto outSize = static_cast<size_t>(outSize_);
+    io::Result r = socket.trySend(b, s);
+    if (r.wouldBlock()) {
+      r = socket.tryWait(POLLOUT);
+      if (!r.succeeded()) {
+        return r;
+      }
+      continue;
+    }
+    if (!r.succeeded()) {
+      return r;
+    }
+    size_t outSize = r.getSize();
     DA(outSize <= s);
 
     b += outSize;
     s -= outSize;
   }
+  return io::Result::ofSize(size);
+}
+
+size_t SocketStream::readv (const iovec *v, size_t vSize) {
+  size_t s = io::getSize(v, vSize);
+  DPRE(s < wouldBlock);
+  if (s == 0) {
+    return 0;
+  }
+
+  ssize_t outSize_ = socket.recv(v, vSize);
+  if (outSize_ == -1) {
+    return wouldBlock;
+  }
+  auto outSize = static_cast<size_t>(outSize_);
+  DA(outSize <= s);
+  if (outSize == 0) {
+    return numeric_limits<size_t>::max();
+  }
+
+  return outSize;
+}
+
+void SocketStream::writev (const iovec *v, size_t vSize) {
+  io::writeAll(v, vSize, [&] (const iovec *w, size_t wSize) -> size_t {
+    ssize_t outSize;
+    while ((outSize = socket.send(w, wSize)) == -1) {
+      socket.wait(POLLOUT);
+    }
+    return static_cast<size_t>(outSize);
+  });
 }
 
-void TcpSocketStream::close () {
+size_t SocketStream::writeSome (const iu8f *b, size_t s) {
+  if (s == 0) {
+    return 0;
+  }
+
+  io::Result r = tryWriteSome(b, s);
+  if (r.wouldBlock()) {
+    return 0;
+  }
+  return r.check();
+}
+
+io::Result SocketStream::tryWriteSome (const iu8f *b, size_t s) noexcept {
+  io::Result r = socket.trySend(b, s);
+  DA(!r.succeeded() || r.getSize() <= s);
+  return r;
+}
+
+void SocketStream::close () {
   if (socket.closed()) {
     return;
   }
 
   DW(, "FINning writing side");
   try {
+    // (Draining requires waiting for the peer.)
+    socket.setNonBlocking(false);
+
     // Send FIN for the writing side of the connection...
     socket.shutdown(SHUT_WR);
 
@@ -403,7 +874,337 @@ void TcpSocketStream::close () {
   socket.close();
 }
 
-PassiveTcpSocket::PassiveTcpSocket (const TcpSocketAddress &listenAddr, iu listenBacklog) : socket(listenAddr) {
+BufferedTcpSocketStream::BufferedTcpSocketStream (TcpSocketStream &&stream, size_t readBufferSize, size_t writeBufferSize) :
+  stream(move(stream)), readBuffer(new iu8f[readBufferSize]), readBufferSize(readBufferSize), readBegin(0), readEnd(0),
+  writeBuffer(new iu8f[writeBufferSize]), writeBufferSize(writeBufferSize), writeSize(0), corked(false)
+{
+  DPRE(readBufferSize != 0);
+  DPRE(writeBufferSize != 0);
+}
+
+TcpSocketStream &BufferedTcpSocketStream::getStream () noexcept {
+  return stream;
+}
+
+size_t BufferedTcpSocketStream::fill () {
+  if (readBegin != 0) {
+    memmove(readBuffer.get(), readBuffer.get() + readBegin, readEnd - readBegin);
+    readEnd -= readBegin;
+    readBegin = 0;
+  }
+  DA(readEnd < readBufferSize);
+
+  size_t s = stream.read(readBuffer.get() + readEnd, readBufferSize - readEnd);
+  if (s != numeric_limits<size_t>::max() && s != wouldBlock) {
+    readEnd += s;
+  }
+  return s;
+}
+
+void BufferedTcpSocketStream::send (const iovec *v, size_t vSize, int flags) {
+  Socket &socket = stream.getSocket();
+  io::writeAll(v, vSize, [&] (const iovec *w, size_t wSize) -> size_t {
+    ssize_t outSize;
+    while ((outSize = socket.send(w, wSize, flags)) == -1) {
+      socket.wait(POLLOUT);
+    }
+    return static_cast<size_t>(outSize);
+  });
+}
+
+size_t BufferedTcpSocketStream::read (iu8f *b, size_t s) {
+  DPRE(s < wouldBlock);
+  if (s == 0) {
+    return 0;
+  }
+
+  if (readBegin == readEnd) {
+    if (s >= readBufferSize) {
+      // Buffering wouldn't save any system calls.
+      return stream.read(b, s);
+    }
+    size_t r = fill();
+    if (r == numeric_limits<size_t>::max() || r == wouldBlock) {
+      return r;
+    }
+  }
+
+  size_t available = readEnd - readBegin;
+  size_t outSize = s < available ? s : available;
+  memcpy(b, readBuffer.get() + readBegin, outSize);
+  consume(outSize);
+  return outSize;
+}
+
+std::span<const iu8f> BufferedTcpSocketStream::peek (size_t s) {
+  DPRE(s <= readBufferSize);
+  while (readEnd - readBegin < s) {
+    size_t r = fill();
+    if (r == numeric_limits<size_t>::max() || r == wouldBlock) {
+      break;
+    }
+  }
+  return std::span<const iu8f>(readBuffer.get() + readBegin, readEnd - readBegin);
+}
+
+void BufferedTcpSocketStream::consume (size_t s) {
+  DPRE(s <= readEnd - readBegin);
+  readBegin += s;
+  if (readBegin == readEnd) {
+    readBegin = readEnd = 0;
+  }
+}
+
+void BufferedTcpSocketStream::write (const iu8f *b, size_t s) {
+  if (s <= writeBufferSize - writeSize) {
+    memcpy(writeBuffer.get() + writeSize, b, s);
+    writeSize += s;
+    return;
+  }
+
+  int flags = corked ? MSG_MORE : 0;
+  if (s < writeBufferSize) {
+    // Top up the buffer, so that a full buffer's worth goes out, and keep the
+    // rest.
+    size_t topUpSize = writeBufferSize - writeSize;
+    memcpy(writeBuffer.get() + writeSize, b, topUpSize);
+    iovec v = {writeBuffer.get(), writeBufferSize};
+    send(&v, 1, flags);
+    memcpy(writeBuffer.get(), b + topUpSize, s - topUpSize);
+    writeSize = s - topUpSize;
+  } else {
+    // Send the buffered data along with the new data.
+    iovec v[2] = {{writeBuffer.get(), writeSize}, {const_cast<iu8f *>(b), s}};
+    send(v, 2, flags);
+    writeSize = 0;
+  }
+}
+
+void BufferedTcpSocketStream::writev (const iovec *v, size_t vSize) {
+  size_t s = io::getSize(v, vSize);
+  if (s <= writeBufferSize - writeSize) {
+    for (const iovec *end = v + vSize; v != end; ++v) {
+      memcpy(writeBuffer.get() + writeSize, v->iov_base, v->iov_len);
+      writeSize += v->iov_len;
+    }
+    return;
+  }
+
+  vector<iovec> w;
+  w.reserve(vSize + 1);
+  w.push_back(iovec{writeBuffer.get(), writeSize});
+  w.insert(w.end(), v, v + vSize);
+  send(w.data(), w.size(), corked ? MSG_MORE : 0);
+  writeSize = 0;
+}
+
+void BufferedTcpSocketStream::flush () {
+  if (writeSize == 0) {
+    return;
+  }
+
+  iovec v = {writeBuffer.get(), writeSize};
+  send(&v, 1, 0);
+  writeSize = 0;
+}
+
+void BufferedTcpSocketStream::cork () noexcept {
+  corked = true;
+}
+
+void BufferedTcpSocketStream::uncork () {
+  corked = false;
+  flush();
+}
+
+void BufferedTcpSocketStream::close () {
+  try {
+    flush();
+  } catch (...) {
+    stream.close();
+    throw;
+  }
+  stream.close();
+}
+
+ZeroCopyTcpSocketStream::ZeroCopyTcpSocketStream (TcpSocketStream &&stream, size_t threshold) :
+  stream(move(stream)), threshold(threshold), enabled(false), firstId(0), pendingCount(0), copiedCount(0)
+{
+  int optval = 1;
+  if (setsockopt(this->stream.getSocket().getDescriptor(), SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval)) == 0) {
+    enabled = true;
+  } else {
+    DW(, "zero-copy sends are unavailable, so all data will be copied");
+  }
+}
+
+TcpSocketStream &ZeroCopyTcpSocketStream::getStream () noexcept {
+  return stream;
+}
+
+bool ZeroCopyTcpSocketStream::isEnabled () const noexcept {
+  return enabled;
+}
+
+void ZeroCopyTcpSocketStream::setThreshold (size_t threshold) noexcept {
+  this->threshold = threshold;
+}
+
+void ZeroCopyTcpSocketStream::reap () {
+  int fd = stream.getSocket().getDescriptor();
+  while (true) {
+    char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+    msghdr m = EMPTY_MSGHDR;
+    m.msg_control = control;
+    m.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &m, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (wouldHaveBlocked()) {
+        break;
+      }
+      throw PlainException(u8string(u8"failed to read the error queue of a network socket") + createStrerror(errno));
+    }
+
+    for (cmsghdr *c = CMSG_FIRSTHDR(&m); c; c = CMSG_NXTHDR(&m, c)) {
+      if (!((c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) || (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR))) {
+        continue;
+      }
+      sock_extended_err e;
+      memcpy(&e, CMSG_DATA(c), sizeof(e));
+      if (e.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+
+      // The notification covers the inclusive range of send numbers
+      // [ee_info, ee_data].
+      if (e.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        copiedCount += e.ee_data - e.ee_info + 1;
+      }
+      for (iu32 id = e.ee_info;; ++id) {
+        size_t i = static_cast<iu32>(id - firstId);
+        if (i < sends.size()) {
+          sends[i].done = true;
+        }
+        if (id == e.ee_data) {
+          break;
+        }
+      }
+    }
+  }
+
+  // (Buffers are released in the order in which they were written.)
+  while (!sends.empty() && sends.front().done) {
+    if (sends.front().last) {
+      completed.push_back(sends.front().token);
+    }
+    sends.pop_front();
+    ++firstId;
+  }
+}
+
+bool ZeroCopyTcpSocketStream::write (const iu8f *b, size_t s, iu64 token) {
+  if (!enabled || s < threshold) {
+    stream.write(b, s);
+    return true;
+  }
+
+  Socket &socket = stream.getSocket();
+  int fd = socket.getDescriptor();
+  size_t zeroCopiedCount = 0;
+  while (s != 0) {
+    ssize_t outSize = ::send(fd, b, s, MSG_ZEROCOPY | MSG_NOSIGNAL);
+    if (outSize == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (wouldHaveBlocked()) {
+        socket.wait(POLLOUT);
+        continue;
+      }
+      if (errno == ENOBUFS) {
+        // The system has run out of memory for tracking zero-copy sends, so
+        // wait for some of them to complete (or, if there are none, copy).
+        if (sends.empty()) {
+          DW(, "ran out of memory for zero-copy sends; copying instead");
+          stream.write(b, s);
+          break;
+        }
+        socket.wait(0);
+        reap();
+        continue;
+      }
+      throw PlainException(u8string(u8"failed to write to a network socket") + createStrerror(errno));
+    }
+
+    // Each successful call is given the next number in sequence.
+    sends.push_back(Send{false, false, 0});
+    ++zeroCopiedCount;
+    b += outSize;
+    s -= static_cast<size_t>(outSize);
+  }
+  // Waiting for completions (on ENOBUFS) can have reaped some of this write's
+  // own sends, but as those are the last outstanding, any that remain are at
+  // the back.
+  size_t outstandingCount = zeroCopiedCount < sends.size() ? zeroCopiedCount : sends.size();
+  if (outstandingCount == 0) {
+    // (Everything has already been released.)
+    return true;
+  }
+
+  sends.back().last = true;
+  sends.back().token = token;
+  ++pendingCount;
+  return false;
+}
+
+size_t ZeroCopyTcpSocketStream::collect (vector<iu64> &r_tokens) {
+  reap();
+  size_t count = completed.size();
+  r_tokens.insert(r_tokens.end(), completed.begin(), completed.end());
+  completed.clear();
+  pendingCount -= count;
+  return count;
+}
+
+void ZeroCopyTcpSocketStream::waitForCompletion () {
+  while (true) {
+    reap();
+    if (!completed.empty() || sends.empty()) {
+      return;
+    }
+    // (Notifications make the socket report POLLERR.)
+    stream.getSocket().wait(0);
+  }
+}
+
+size_t ZeroCopyTcpSocketStream::getPendingCount () const noexcept {
+  return pendingCount;
+}
+
+iu64 ZeroCopyTcpSocketStream::getCopiedCount () const noexcept {
+  return copiedCount;
+}
+
+void ZeroCopyTcpSocketStream::close () {
+  while (true) {
+    reap();
+    if (sends.empty()) {
+      break;
+    }
+    stream.getSocket().wait(0);
+  }
+  stream.close();
+}
+
+PassiveTcpSocket::PassiveTcpSocket (const TcpSocketAddress &listenAddr, iu listenBacklog) : PassiveTcpSocket(listenAddr, listenBacklog, false) {
+}
+
+PassiveTcpSocket::PassiveTcpSocket (const TcpSocketAddress &listenAddr, iu listenBacklog, bool reusePort) : socket(listenAddr) {
+  if (reusePort) {
+    socket.setReusePort();
+  }
   socket.bind(listenAddr);
   socket.listen(listenBacklog);
 }
@@ -413,10 +1214,351 @@ PassiveTcpSocket::PassiveTcpSocket (const TcpSocketAddress &listenAddr) : Passiv
 
 TcpSocketStream PassiveTcpSocket::accept (bool keepalive) {
   Socket s = socket.accept();
+  while (s.closed()) {
+    socket.wait(POLLIN);
+    s = socket.accept();
+  }
   s.setOptions(keepalive);
   return TcpSocketStream(move(s));
 }
 
+optional<TcpSocketStream> PassiveTcpSocket::tryAccept (bool keepalive) {
+  Socket s = socket.accept();
+  if (s.closed()) {
+    return optional<TcpSocketStream>();
+  }
+  s.setOptions(keepalive);
+  return optional<TcpSocketStream>(TcpSocketStream(move(s)));
+}
+
+void PassiveTcpSocket::setInheritedOptions (bool keepalive) {
+  socket.setOptions(keepalive);
+}
+
+size_t PassiveTcpSocket::acceptBatch (vector<tuple<TcpSocketStream, TcpSocketAddress>> &r_accepted, size_t maxCount) {
+  size_t count = 0;
+  for (; count != maxCount; ++count) {
+    optional<TcpSocketAddress> peerAddr;
+    Socket s = socket.accept(SOCK_NONBLOCK | SOCK_CLOEXEC, peerAddr);
+    if (s.closed()) {
+      break;
+    }
+    DA(peerAddr);
+    r_accepted.emplace_back(TcpSocketStream(move(s)), move(*peerAddr));
+  }
+  return count;
+}
+
+PassiveUnixSocket::PassiveUnixSocket (const UnixSocketAddress &listenAddr, iu listenBacklog) : socket(listenAddr) {
+  socket.bind(listenAddr);
+  socket.listen(listenBacklog);
+}
+
+SocketStream PassiveUnixSocket::accept () {
+  Socket s = socket.accept();
+  while (s.closed()) {
+    socket.wait(POLLIN);
+    s = socket.accept();
+  }
+  return SocketStream(move(s));
+}
+
+optional<SocketStream> PassiveUnixSocket::tryAccept () {
+  Socket s = socket.accept();
+  if (s.closed()) {
+    return optional<SocketStream>();
+  }
+  return optional<SocketStream>(SocketStream(move(s)));
+}
+
+Socket createUdpSocket (sa_family_t family) {
+  int s = ::socket(family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+  if (s == -1) {
+    throw PlainException(u8string(u8"failed to create a network socket") + createStrerror(errno));
+  }
+  return Socket(s);
+}
+
+constexpr size_t UDP_RECEIVE_CONTROL_SIZE = CMSG_SPACE(sizeof(int));
+constexpr size_t UDP_SEND_CONTROL_SIZE = CMSG_SPACE(sizeof(iu16));
+
+size_t getUdpBuffersSize (size_t bufferCount, size_t bufferSize) {
+  DPRE(bufferCount != 0);
+  if (bufferSize > numeric_limits<size_t>::max() / bufferCount || UDP_RECEIVE_CONTROL_SIZE > numeric_limits<size_t>::max() / bufferCount) {
+    throw PlainException(u8string(u8"failed to create receive buffers for a network socket (requested size was too big)"));
+  }
+  return bufferCount * bufferSize;
+}
+
+UdpSocket::UdpSocket (const TcpSocketAddress &bindAddr, size_t bufferCount, size_t bufferSize) :
+  socket(createUdpSocket(bindAddr.getFamily())), bufferSize(bufferSize), bufferCount(bufferCount),
+  buffers(new iu8f[getUdpBuffersSize(bufferCount, bufferSize)]), receiveV(new iovec[bufferCount]), sourceAddrs(new sockaddr_storage[bufferCount]),
+  receiveControls(new char[bufferCount * UDP_RECEIVE_CONTROL_SIZE]), receiveHeaders(new mmsghdr[bufferCount]())
+{
+  DPRE(bufferCount != 0);
+  DPRE(bufferSize != 0);
+  socket.bind(bindAddr);
+
+  for (size_t i = 0; i != bufferCount; ++i) {
+    receiveV[i].iov_base = buffers.get() + i * bufferSize;
+    receiveV[i].iov_len = bufferSize;
+    msghdr &m = receiveHeaders[i].msg_hdr;
+    m.msg_name = &sourceAddrs[i];
+    m.msg_iov = &receiveV[i];
+    m.msg_iovlen = 1;
+    m.msg_control = receiveControls.get() + i * UDP_RECEIVE_CONTROL_SIZE;
+  }
+  received.reserve(bufferCount);
+}
+
+Socket &UdpSocket::getSocket () noexcept {
+  return socket;
+}
+
+TcpSocketAddress UdpSocket::getLocalAddress () const {
+  sockaddr_storage addr;
+  socklen_t addrSize = sizeof(addr);
+  if (getsockname(socket.getDescriptor(), reinterpret_cast<sockaddr *>(&addr), &addrSize) == -1) {
+    throw PlainException(u8string(u8"failed to get the address of a network socket") + createStrerror(errno));
+  }
+  optional<TcpSocketAddress> r = TcpSocketAddress::get(addr);
+  DA(r);
+  return *r;
+}
+
+void UdpSocket::connect (const TcpSocketAddress &addr) {
+  socket.connect(addr);
+}
+
+void UdpSocket::setGro (bool gro) {
+  int optval = gro;
+  if (setsockopt(socket.getDescriptor(), SOL_UDP, UDP_GRO, &optval, sizeof(optval)) == -1) {
+    throw PlainException(u8string(u8"failed to set the receive offload mode of a network socket") + createStrerror(errno));
+  }
+}
+
+std::span<const UdpSocket::ReceivedDatagram> UdpSocket::receive () {
+  received.clear();
+  // (The system overwrites the sizes, so they must be reset each time.)
+  for (size_t i = 0; i != bufferCount; ++i) {
+    msghdr &m = receiveHeaders[i].msg_hdr;
+    m.msg_namelen = sizeof(sockaddr_storage);
+    m.msg_controllen = UDP_RECEIVE_CONTROL_SIZE;
+    m.msg_flags = 0;
+  }
+
+  int r = recvmmsg(socket.getDescriptor(), receiveHeaders.get(), static_cast<unsigned>(bufferCount), MSG_WAITFORONE, nullptr);
+  if (r == -1) {
+    if (wouldHaveBlocked()) {
+      return std::span<const ReceivedDatagram>();
+    }
+    throw PlainException(u8string(u8"failed to read from a network socket") + createStrerror(errno));
+  }
+
+  for (size_t i = 0; i != static_cast<size_t>(r); ++i) {
+    msghdr &m = receiveHeaders[i].msg_hdr;
+    size_t s = receiveHeaders[i].msg_len;
+    size_t segmentSize = s;
+    for (cmsghdr *c = CMSG_FIRSTHDR(&m); c; c = CMSG_NXTHDR(&m, c)) {
+      if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+        int gsoSize;
+        std::memcpy(&gsoSize, CMSG_DATA(c), sizeof(gsoSize));
+        segmentSize = unsign(gsoSize);
+      }
+    }
+    received.push_back(ReceivedDatagram{
+      std::span<const iu8f>(buffers.get() + i * bufferSize, s < bufferSize ? s : bufferSize),
+      TcpSocketAddress::get(sourceAddrs[i]),
+      segmentSize,
+      (m.msg_flags & MSG_TRUNC) != 0
+    });
+  }
+  return std::span<const ReceivedDatagram>(received);
+}
+
+size_t UdpSocket::send (const Datagram *d, size_t dSize) {
+  sendHeaders.assign(dSize, mmsghdr());
+  sendControls.assign(dSize * UDP_SEND_CONTROL_SIZE, 0);
+  for (size_t i = 0; i != dSize; ++i) {
+    msghdr &m = sendHeaders[i].msg_hdr;
+    m.msg_iov = const_cast<iovec *>(d[i].v);
+    m.msg_iovlen = d[i].vSize < IOV_MAX ? d[i].vSize : IOV_MAX;
+    if (d[i].destination) {
+      tuple<const sockaddr *, socklen_t> o = d[i].destination->getSocketAddress();
+      m.msg_name = const_cast<sockaddr *>(get<0>(o));
+      m.msg_namelen = get<1>(o);
+    }
+    if (d[i].segmentSize != 0) {
+      m.msg_control = sendControls.data() + i * UDP_SEND_CONTROL_SIZE;
+      m.msg_controllen = UDP_SEND_CONTROL_SIZE;
+      cmsghdr *c = CMSG_FIRSTHDR(&m);
+      c->cmsg_level = SOL_UDP;
+      c->cmsg_type = UDP_SEGMENT;
+      c->cmsg_len = CMSG_LEN(sizeof(iu16));
+      iu16 segmentSize = static_cast<iu16>(d[i].segmentSize);
+      std::memcpy(CMSG_DATA(c), &segmentSize, sizeof(segmentSize));
+    }
+  }
+
+  int r = sendmmsg(socket.getDescriptor(), sendHeaders.data(), static_cast<unsigned>(dSize), 0);
+  if (r == -1) {
+    if (wouldHaveBlocked()) {
+      return 0;
+    }
+    throw PlainException(u8string(u8"failed to write to a network socket") + createStrerror(errno));
+  }
+  return static_cast<size_t>(r);
+}
+
+ShardedTcpListener::ShardedTcpListener (const TcpSocketAddress &listenAddr, iu listenBacklog, size_t shardCount, bool pinToCpus, bool keepalive, Handler handler) : handler(move(handler)) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+    throw PlainException(u8string(u8"failed to get the CPUs available to the process") + createStrerror(errno));
+  }
+  vector<int> cpuIds;
+  for (size_t cpu = 0; cpu != CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &cpus)) {
+      cpuIds.push_back(static_cast<int>(cpu));
+    }
+  }
+  DA(!cpuIds.empty());
+  if (shardCount == 0) {
+    shardCount = cpuIds.size();
+  }
+
+  for (size_t i = 0; i != shardCount; ++i) {
+    shards.push_back(std::make_unique<Shard>(listenAddr, listenBacklog, pinToCpus ? cpuIds[i % cpuIds.size()] : -1));
+    Shard &shard = *shards.back();
+    shard.socket.socket.setNonBlocking(true);
+    shard.socket.setInheritedOptions(keepalive);
+    if (shard.cpu != -1) {
+      shard.socket.socket.setIncomingCpu(shard.cpu);
+    }
+  }
+
+  try {
+    for (auto &shard : shards) {
+      Shard *s = shard.get();
+      s->thread = std::thread([this, s] () {
+        run(*s);
+      });
+    }
+  } catch (...) {
+    stop();
+    throw;
+  }
+}
+
+ShardedTcpListener::~ShardedTcpListener () noexcept {
+  stop();
+}
+
+ShardedTcpListener::Shard::Shard (const TcpSocketAddress &listenAddr, iu listenBacklog, int cpu) : socket(listenAddr, listenBacklog, true), cpu(cpu), retryTimerFd(-1) {
+  retryTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (retryTimerFd == -1) {
+    throw PlainException(u8string(u8"failed to create a timerfd") + createStrerror(errno));
+  }
+}
+
+ShardedTcpListener::Shard::~Shard () noexcept {
+  if (retryTimerFd != -1) {
+    ::close(retryTimerFd);
+  }
+}
+
+// How long a shard stops accepting connections for after failing to.
+constexpr long ACCEPT_RETRY_DELAY_NS = 100000000;
+
+void ShardedTcpListener::pauseAccepting (Shard &shard) {
+  itimerspec t = {};
+  t.it_value.tv_nsec = ACCEPT_RETRY_DELAY_NS;
+  if (timerfd_settime(shard.retryTimerFd, 0, &t, nullptr) != 0) {
+    throw PlainException(u8string(u8"failed to set a timerfd") + createStrerror(errno));
+  }
+  // (The listening socket stays readable, so leaving it watched would just
+  // spin.)
+  shard.reactor.modify(shard.socket.socket.getDescriptor(), 0);
+}
+
+void ShardedTcpListener::run (Shard &shard) {
+  if (shard.cpu != -1) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(unsign(shard.cpu), &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+      DW(, "failed to pin shard to CPU ", shard.cpu);
+    }
+  }
+
+  // (Nothing can be done about a failure of the reactor itself but stop the
+  // shard, which mustn't take the rest of the process down with it.)
+  try {
+    int listenFd = shard.socket.socket.getDescriptor();
+    shard.reactor.add(shard.retryTimerFd, EPOLLIN, [&] (io::event::Reactor::Events) {
+      iu64 expiryCount;
+      ssize_t r = ::read(shard.retryTimerFd, &expiryCount, sizeof(expiryCount));
+      static_cast<void>(r);
+      try {
+        shard.reactor.modify(listenFd, EPOLLIN);
+      } catch (PlainException &) {
+        DW(, "shard failed to resume accepting connections");
+      }
+    });
+
+    vector<tuple<TcpSocketStream, TcpSocketAddress>> accepted;
+    shard.reactor.add(listenFd, EPOLLIN, [&] (io::event::Reactor::Events) {
+      constexpr size_t MAX_BATCH_SIZE = 64;
+      bool failed;
+      do {
+        accepted.clear();
+        failed = false;
+        try {
+          shard.socket.acceptBatch(accepted, MAX_BATCH_SIZE);
+        } catch (...) {
+          // e.g. the process has run out of file descriptors; try again later.
+          DW(, "shard failed to accept a connection");
+          failed = true;
+        }
+
+        for (auto &connection : accepted) {
+          try {
+            handler(shard.reactor, move(get<0>(connection)));
+          } catch (...) {
+            DW(, "shard handler failed on a connection");
+          }
+        }
+      } while (!failed && accepted.size() == MAX_BATCH_SIZE);
+
+      if (failed) {
+        try {
+          pauseAccepting(shard);
+        } catch (PlainException &) {
+          DW(, "shard failed to stop accepting connections for a while");
+        }
+      }
+    });
+    shard.reactor.run();
+  } catch (...) {
+    DW(, "shard stopped after its reactor failed");
+  }
+}
+
+size_t ShardedTcpListener::getShardCount () const noexcept {
+  return shards.size();
+}
+
+void ShardedTcpListener::stop () noexcept {
+  for (auto &shard : shards) {
+    shard->reactor.stop();
+  }
+  for (auto &shard : shards) {
+    if (shard->thread.joinable()) {
+      shard->thread.join();
+    }
+  }
+}
+
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
 }
@@ -6,11 +6,23 @@
 #ifndef IO_SOCKET_ALREADYINCLUDED
 #define IO_SOCKET_ALREADYINCLUDED
 
+#include "io.hpp"
+#include "io_event.hpp"
 #include <core.hpp>
 #include <iterators.hpp>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <chrono>
+#include <deque>
+#include <limits>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <thread>
 #include <vector>
 
 namespace io::socket {
@@ -20,7 +32,7 @@ namespace io::socket {
 extern DC();
 
 /**
-  Represents an IP address plus a TCP port.
+  Represents an IP address plus a TCP port (or, for UdpSocket, a UDP port).
 */
 class TcpSocketAddress {
   /**
@@ -39,11 +51,17 @@ class TcpSocketAddress {
 
   prv explicit TcpSocketAddress (const sockaddr_in &socketAddr4);
   prv explicit TcpSocketAddress (const sockaddr_in6 &socketAddr6);
+  prv static std::optional<TcpSocketAddress> get (const sockaddr_storage &socketAddr) noexcept;
 
   /**
     Gets the corresponding family (one of {@c AF_INET} or {@c AF_INET6}).
   */
   pub sa_family_t getFamily () const noexcept;
+  /**
+    Gets the port number (in host byte order).
+  */
+  pub iu16f getPort () const noexcept;
+  pub void setPort (iu16f port) noexcept;
   /**
     Returns a pointer to and the {@c sizeof} a {@c sockaddr} structure that
     describes this object.
@@ -77,51 +95,595 @@ class TcpSocketAddress {
     wildcard address).
   */
   pub static void get (std::vector<TcpSocketAddress> &r_addrs, iu16f port);
+
+  friend class Socket;
+  friend class UdpSocket;
+};
+
+/**
+  Represents the address of a Unix-domain socket: either a filesystem path or
+  a name in the (Linux-specific) abstract namespace, which has no presence in
+  the filesystem and disappears once the socket bound to it is closed.
+*/
+class UnixSocketAddress {
+  /**
+    The corresponding socket type ({@c SOCK_STREAM}).
+  */
+  pub static constexpr int type = SOCK_STREAM;
+  /**
+    The corresponding protocol (the default).
+  */
+  pub static constexpr int protocol = 0;
+
+  prv sockaddr_un socketAddr;
+  prv socklen_t socketAddrSize;
+
+  /**
+    Creates an address for the given filesystem path or (if {@c abstract} is
+    true) the given name in the abstract namespace.
+
+    @throw if the path or name is too long.
+  */
+  pub UnixSocketAddress (const core::u8string &name, bool abstract);
+
+  /**
+    Gets the corresponding family ({@c AF_UNIX}).
+  */
+  pub sa_family_t getFamily () const noexcept;
+  pub bool isAbstract () const noexcept;
+  /**
+    Returns a pointer to and the size of a {@c sockaddr} structure that
+    describes this object.
+  */
+  pub std::tuple<const sockaddr *, socklen_t> getSocketAddress () const noexcept;
+  /**
+    Gets a human-readable representation of this object (where a name in the
+    abstract namespace is prefixed with '@').
+  */
+  pub void getSocketAddress (core::u8string &r_r) const noexcept;
+};
+
+/**
+  A set of options for Socket::setOptions(), of which those that are left
+  empty are left as they are.
+*/
+struct SocketOptions {
+  /**
+    Whether to send small segments straight away ({@c TCP_NODELAY}).
+  */
+  std::optional<bool> noDelay;
+  /**
+    Whether to probe idle connections ({@c SO_KEEPALIVE}).
+  */
+  std::optional<bool> keepalive;
+  /**
+    The size of the send buffer ({@c SO_SNDBUF}; the system doubles it to
+    allow for its own overhead).
+  */
+  std::optional<int> sendBufferSize;
+  /**
+    The size of the receive buffer ({@c SO_RCVBUF}; as for
+    {@c sendBufferSize}).
+  */
+  std::optional<int> receiveBufferSize;
+  /**
+    Whether to acknowledge received data straight away rather than delaying
+    in the hope of piggybacking the acknowledgement on a reply
+    ({@c TCP_QUICKACK}). The system may revert this by itself, so it has to be
+    set again (e.g. after each read) to keep it in effect.
+  */
+  std::optional<bool> quickAck;
+  /**
+    The most unsent data that the send buffer may hold before the socket
+    stops being ready for writing ({@c TCP_NOTSENT_LOWAT}), which keeps the
+    latency of newly-written data down.
+  */
+  std::optional<iu32> notSentLowWatermark;
+  /**
+    How long a read may busy-poll the device for data before sleeping
+    ({@c SO_BUSY_POLL}).
+  */
+  std::optional<std::chrono::microseconds> busyPoll;
+  /**
+    How long sent data may go unacknowledged before the connection is
+    dropped ({@c TCP_USER_TIMEOUT}).
+  */
+  std::optional<std::chrono::milliseconds> userTimeout;
+  /**
+    The name of the congestion control algorithm (e.g. "cubic" or "bbr";
+    {@c TCP_CONGESTION}).
+  */
+  std::optional<core::u8string> congestionControl;
+};
+
+/**
+  A snapshot of the state of a TCP connection (from {@c TCP_INFO}, plus the
+  sizes of the send queue).
+*/
+struct TcpInfo {
+  /**
+    The connection's state (e.g. {@c TCP_ESTABLISHED}).
+  */
+  iu8 state;
+  /**
+    The smoothed round-trip time.
+  */
+  std::chrono::microseconds rtt;
+  std::chrono::microseconds rttVariance;
+  /**
+    The current retransmission timeout.
+  */
+  std::chrono::microseconds retransmitTimeout;
+  /**
+    The congestion window, in segments.
+  */
+  iu32 congestionWindow;
+  /**
+    The slow start threshold, in segments.
+  */
+  iu32 slowStartThreshold;
+  /**
+    The maximum segment size for sending.
+  */
+  iu32 sendMss;
+  /**
+    The number of segments sent but not yet acknowledged.
+  */
+  iu32 unackedSegments;
+  /**
+    The number of segments thought to have been lost.
+  */
+  iu32 lostSegments;
+  /**
+    The number of segments being retransmitted.
+  */
+  iu32 retransmittingSegments;
+  /**
+    The number of retransmissions over the life of the connection.
+  */
+  iu32 totalRetransmits;
+  /**
+    The number of bytes sent but not yet acknowledged.
+  */
+  size_t unackedSize;
+  /**
+    The number of bytes written but not yet sent.
+  */
+  size_t unsentSize;
 };
 
 class Socket {
   prv int s;
 
-  prv explicit Socket (decltype(s) s);
+  prv Socket () noexcept;
+  /**
+    Takes ownership of the given socket file descriptor.
+  */
+  pub explicit Socket (decltype(s) s);
   prv Socket (sa_family_t family, int type, int protocol);
+  /**
+    Creates a socket (with close-on-exec set, as for all sockets that this
+    library creates or accepts) for the given address's family.
+  */
   pub explicit Socket (const TcpSocketAddress &addr);
+  pub explicit Socket (const UnixSocketAddress &addr);
   Socket (const Socket &) = delete;
   Socket &operator= (const Socket &) = delete;
   pub Socket (Socket &&) noexcept;
   pub Socket &operator= (Socket &&) noexcept;
   pub ~Socket () noexcept;
 
+  /**
+    Creates a pair of connected Unix-domain stream sockets (via
+    {@c socketpair}, with close-on-exec set).
+  */
+  pub static std::tuple<Socket, Socket> createPair ();
+
   pub void bind (const TcpSocketAddress &addr);
+  /**
+    Binds the socket to the given address, which (if it's a filesystem path)
+    must not already exist.
+  */
+  pub void bind (const UnixSocketAddress &addr);
   pub void listen (iu listenBacklog);
+  /**
+    Accepts a connection (with close-on-exec set) or, if the socket is in
+    non-blocking mode and there are no pending connections, returns a closed
+    Socket.
+  */
   pub Socket accept ();
+  /**
+    Accepts a connection (via {@c accept4}, with the given {@c SOCK_NONBLOCK}
+    and {@c SOCK_CLOEXEC} flags), getting the address of its peer (if it's
+    an IP address) or, if the socket is in non-blocking mode and there are no
+    pending connections, returns a closed Socket.
+  */
+  pub Socket accept (int flags, std::optional<TcpSocketAddress> &r_peerAddr);
   pub void connect (const TcpSocketAddress &addr);
+  pub void connect (const UnixSocketAddress &addr);
+  /**
+    Starts connecting the socket (which must be in non-blocking mode) to the
+    given address, returning true if the connection was made straight away or
+    false if it's in progress (in which case the socket becomes ready for
+    writing once the attempt has finished, and getError() gives its outcome).
+  */
+  pub bool startConnect (const TcpSocketAddress &addr);
+  /**
+    Gets (and clears) the socket's pending error ({@c SO_ERROR}), or zero if
+    there is none.
+  */
+  pub int getError ();
+  /**
+    Sets the options for a connection: {@c TCP_NODELAY} and the given
+    keepalive setting. This is also done (with the same failure behaviour) by
+    the connecting TcpSocketStream constructor and by
+    PassiveTcpSocket::accept() and tryAccept().
+
+    @throw if either option couldn't be set.
+  */
   pub void setOptions (bool keepalive);
+  /**
+    Sets the given options.
+
+    @throw if any of the options couldn't be set (in which case those before
+    it in SocketOptions's order have been).
+  */
+  pub void setOptions (const SocketOptions &options);
+  /**
+    Gets a snapshot of the state of the (TCP) connection.
+  */
+  pub TcpInfo getTcpInfo () const;
+  /**
+    Lets other sockets bind to the same address and port (via
+    {@c SO_REUSEPORT}), so that the system spreads incoming connections across
+    them. Must be called before bind().
+  */
+  pub void setReusePort ();
+  /**
+    Makes the system prefer, for new connections, the socket (amongst those
+    sharing a port) associated with the given CPU (via {@c SO_INCOMING_CPU}).
+  */
+  pub void setIncomingCpu (int cpu);
+  /**
+    Puts the socket into (or takes it out of) non-blocking mode, in which
+    operations that would have to wait instead return immediately, indicating
+    that they would block (and without throwing).
+  */
+  pub void setNonBlocking (bool nonBlocking);
+  /**
+    Receives data, returning -1 if the socket is in non-blocking mode and no
+    data is available.
+  */
   pub ssize_t recv (void *buf, size_t len);
+  /**
+    Sends data, returning -1 if the socket is in non-blocking mode and no
+    data can be sent without waiting. A peer that has gone away gives a
+    failure ({@c EPIPE}) rather than {@c SIGPIPE}.
+  */
   pub ssize_t send (const void *buf, size_t len);
+  pub ssize_t recv (const iovec *v, size_t vSize);
+  pub ssize_t send (const iovec *v, size_t vSize);
+  /**
+    Sends data (as for send()) with the given {@c MSG_*} flags (e.g.
+    {@c MSG_MORE}, to tell the system that more data is about to follow, so
+    that it needn't send a partial segment yet).
+  */
+  pub ssize_t send (const iovec *v, size_t vSize, int flags);
+  /**
+    Receives data as for recv(), but returns (rather than throws) any failure,
+    including (in non-blocking mode) {@c EAGAIN} if no data is available.
+  */
+  pub io::Result tryRecv (void *buf, size_t len) noexcept;
+  pub io::Result tryRecv (const iovec *v, size_t vSize) noexcept;
+  /**
+    Sends data as for send(), but returns (rather than throws) any failure,
+    including (in non-blocking mode) {@c EAGAIN} if no data can be sent
+    without waiting.
+  */
+  pub io::Result trySend (const void *buf, size_t len) noexcept;
+  pub io::Result trySend (const iovec *v, size_t vSize, int flags) noexcept;
+  /**
+    Sends data (as for send(), of which there must be at least one byte) over
+    a Unix-domain socket along with duplicates of the given file descriptors
+    (via {@c SCM_RIGHTS}), which arrive with the data's first byte.
+  */
+  pub ssize_t sendDescriptors (const iovec *v, size_t vSize, const int *fds, size_t fdsSize);
+  /**
+    Receives data (as for recv()) over a Unix-domain socket, appending to the
+    given vector any file descriptors (with close-on-exec set) that arrived
+    with it, which the caller then owns. At most the given number of
+    descriptors can be received at once; if more arrived, r_truncated is set
+    and none are appended (those that arrived are closed), but the data is
+    still received as usual (so that the stream stays in step with the peer).
+  */
+  pub ssize_t recvDescriptors (const iovec *v, size_t vSize, std::vector<int> &r_fds, size_t maxFdsSize, bool &r_truncated);
+  /**
+    Makes the system hold back partial segments until the socket is uncorked
+    (via {@c TCP_CORK}), so that the pieces of a response that are written
+    separately (including any sent via io::transfer::transfer()) go out in
+    full segments.
+  */
+  pub void setCork (bool corked);
+  /**
+    Waits until the socket is ready for the given {@c poll} events.
+  */
+  pub void wait (short events);
+  /**
+    Waits as for wait(), but returns (rather than throws) any failure.
+  */
+  pub io::Result tryWait (short events) noexcept;
   pub void shutdown (int how);
   pub void close ();
   pub bool closed () const noexcept;
+  /**
+    Gets the socket's file descriptor.
+  */
+  pub int getDescriptor () const noexcept;
 };
 
 /**
-  An {@c InputStream} and {@c OutputStream} for TCP sockets.
+  An {@c InputStream} and {@c OutputStream} for connected stream sockets
+  (TCP or Unix-domain, including those from Socket::createPair()). In non-blocking
+  mode (see Socket::setNonBlocking()), read() and readv() return
+  {@c wouldBlock} if no data is available, write() and writev() still write
+  everything (waiting where necessary) and writeSome() writes only what it can
+  without waiting.
 */
-class TcpSocketStream {
+class SocketStream {
+  /**
+    The value returned by read() and readv() in non-blocking mode when no data
+    is available.
+  */
+  pub static constexpr size_t wouldBlock = std::numeric_limits<size_t>::max() - 1;
+
   prv Socket socket;
 
-  prv explicit TcpSocketStream (Socket &&socket);
+  /**
+    Takes on the given connected TCP socket.
+  */
+  pub explicit SocketStream (Socket &&socket);
   /**
     Creates a socket and connects it to the given address.
    */
-  pub TcpSocketStream (const TcpSocketAddress &targetAddr, bool keepalive);
+  pub SocketStream (const TcpSocketAddress &targetAddr, bool keepalive);
+  pub explicit SocketStream (const UnixSocketAddress &targetAddr);
+  /**
+    Creates a pair of streams that are connected to each other (see
+    Socket::createPair()).
+  */
+  pub static std::tuple<SocketStream, SocketStream> createPair ();
 
+  /**
+    Gets the underlying socket.
+  */
+  pub Socket &getSocket () noexcept;
   pub size_t read (iu8f *b, size_t s);
   pub void write (const iu8f *b, size_t s);
+  /**
+    Reads (with a single system call) into the buffers described by the given
+    sequence of {@c iovec}s, filling each in turn, returning the total number of
+    bytes read or, at the end of the stream, {@c numeric_limits<size_t>::max()}.
+  */
+  pub size_t readv (const iovec *v, size_t vSize);
+  /**
+    Writes all of the data described by the given sequence of {@c iovec}s
+    (with a single system call, unless the system accepts only part of the
+    data, in which case sending resumes from exactly where it stopped).
+  */
+  pub void writev (const iovec *v, size_t vSize);
+  /**
+    Writes as much of the given data as can be written without waiting
+    (which, in blocking mode, is at least some of it).
+
+    @return the number of bytes written.
+  */
+  pub size_t writeSome (const iu8f *b, size_t s);
+  /**
+    Reads as for read(), returning (rather than throwing) any failure,
+    including (in non-blocking mode) {@c EAGAIN} if no data is available, and
+    gives a size of zero at the end of the stream. A request for zero bytes
+    fails with {@c EINVAL}, so that a size of zero is unambiguous.
+  */
+  pub io::Result tryRead (iu8f *b, size_t s) noexcept;
+  /**
+    Writes as for write(), but returns (rather than throws) any failure.
+  */
+  pub io::Result tryWrite (const iu8f *b, size_t s) noexcept;
+  /**
+    Writes as for writeSome(), but returns (rather than throws) any failure,
+    including (in non-blocking mode) {@c EAGAIN} if nothing could be written.
+  */
+  pub io::Result tryWriteSome (const iu8f *b, size_t s) noexcept;
+  /**
+    Sends FIN for the writing side and then waits for (discarding any data
+    from) the peer's FIN before closing the socket, so that the system doesn't
+    reset the connection. This can take as long as the peer likes (see
+    io::linger::LingeringCloser for closing in the background, within limits).
+  */
   pub void close ();
 
   friend class PassiveTcpSocket;
 };
 
+static_assert(io::InputStream<SocketStream> && io::OutputStream<SocketStream>);
+
+/**
+  (The name under which SocketStream was introduced, when it supported only
+  TCP.)
+*/
+typedef SocketStream TcpSocketStream;
+
+/**
+  A TcpSocketStream with user-space buffers on both sides. Writes are gathered
+  in the write buffer and sent when it fills up or when flush() is called, so
+  that a protocol encoder's many small writes go out in a few full segments
+  (despite {@c TCP_NODELAY}). Between cork() and uncork(), data sent because the
+  write buffer filled up is marked with {@c MSG_MORE}, so that the system holds
+  back the tail of a multi-part response until all of it has been written.
+  Reads are served from the read buffer, which is refilled with as much as
+  a single system call provides, and peek() lets a protocol header be examined
+  in place before being consumed. Unflushed data is discarded if the stream is
+  destroyed without flush() or close() having been called.
+*/
+class BufferedTcpSocketStream {
+  /**
+    The value returned by read() in non-blocking mode when no data is
+    available.
+  */
+  pub static constexpr size_t wouldBlock = TcpSocketStream::wouldBlock;
+
+  prv TcpSocketStream stream;
+  prv std::unique_ptr<iu8f[]> readBuffer;
+  prv size_t readBufferSize;
+  prv size_t readBegin;
+  prv size_t readEnd;
+  prv std::unique_ptr<iu8f[]> writeBuffer;
+  prv size_t writeBufferSize;
+  prv size_t writeSize;
+  prv bool corked;
+
+  /**
+    Takes on the given stream, with read and write buffers of the given sizes.
+  */
+  pub BufferedTcpSocketStream (TcpSocketStream &&stream, size_t readBufferSize, size_t writeBufferSize);
+
+  /**
+    Gets the underlying stream (which must not be read from or written to
+    directly while data is buffered).
+  */
+  pub TcpSocketStream &getStream () noexcept;
+  prv size_t fill ();
+  prv void send (const iovec *v, size_t vSize, int flags);
+  /**
+    Reads up to the given number of bytes, returning the number read or, at
+    the end of the stream, {@c numeric_limits<size_t>::max()} (or, in
+    non-blocking mode, {@c wouldBlock} if no data is available).
+  */
+  pub size_t read (iu8f *b, size_t s);
+  /**
+    Tries to get at least the given number of bytes (which must not be more
+    than the read buffer's size) into the read buffer, without consuming
+    them, and returns all of the buffered data. Less than requested is
+    returned only at the end of the stream or, in non-blocking mode, if no
+    more data is available.
+  */
+  pub std::span<const iu8f> peek (size_t s);
+  /**
+    Consumes the given number of bytes (which must not be more than are
+    buffered) from the read buffer.
+  */
+  pub void consume (size_t s);
+  /**
+    Writes all of the given data (into the write buffer, sending the
+    buffered data first if the write buffer would overflow).
+  */
+  pub void write (const iu8f *b, size_t s);
+  /**
+    Writes all of the data described by the given sequence of {@c iovec}s
+    (into the write buffer, sending as for write()).
+  */
+  pub void writev (const iovec *v, size_t vSize);
+  /**
+    Sends all of the buffered data (waiting where necessary), letting the
+    system send any partial segment straight away.
+  */
+  pub void flush ();
+  /**
+    Starts a multi-part response: until uncork(), data sent because the write
+    buffer has filled up is marked with {@c MSG_MORE}.
+  */
+  pub void cork () noexcept;
+  /**
+    Ends a multi-part response, flushing all of it.
+  */
+  pub void uncork ();
+  /**
+    Flushes the buffered data and closes the stream (as for
+    TcpSocketStream::close()).
+  */
+  pub void close ();
+};
+
+/**
+  A TcpSocketStream that sends large buffers without copying them into the
+  kernel (via {@c MSG_ZEROCOPY}), with the kernel instead referring to the
+  caller's memory until the data has been acknowledged. Each write() is
+  tagged with a caller-chosen token, and collect() reports (by token, in the
+  order written) the writes whose buffers may be reused. Writes smaller than
+  the threshold (for which setting up the page pinning costs more than copying
+  would) are copied as usual, as are all writes if the system doesn't support
+  zero-copy sends on the socket.
+*/
+class ZeroCopyTcpSocketStream {
+  prv struct Send {
+    bool done;
+    bool last;
+    iu64 token;
+  };
+
+  prv TcpSocketStream stream;
+  prv size_t threshold;
+  prv bool enabled;
+  prv iu32 firstId;
+  prv std::deque<Send> sends;
+  prv std::vector<iu64> completed;
+  prv size_t pendingCount;
+  prv iu64 copiedCount;
+
+  /**
+    Takes on the given stream, enabling zero-copy sends (via
+    {@c SO_ZEROCOPY}) for writes of at least the given number of bytes.
+  */
+  pub ZeroCopyTcpSocketStream (TcpSocketStream &&stream, size_t threshold);
+
+  /**
+    Gets the underlying stream.
+  */
+  pub TcpSocketStream &getStream () noexcept;
+  /**
+    Gets whether zero-copy sends are enabled on the socket.
+  */
+  pub bool isEnabled () const noexcept;
+  pub void setThreshold (size_t threshold) noexcept;
+  prv void reap ();
+  /**
+    Writes all of the given data (waiting where necessary).
+
+    @return true if the buffer may be reused straight away (because its data
+    was copied) or false if it must remain unchanged until collect() reports
+    the given token.
+  */
+  pub bool write (const iu8f *b, size_t s, iu64 token);
+  /**
+    Appends to the given vector the tokens of the writes (in the order in
+    which they were made) whose buffers may now be reused, without waiting.
+
+    @return the number of tokens appended.
+  */
+  pub size_t collect (std::vector<iu64> &r_tokens);
+  /**
+    Waits until at least one write's buffer may be reused (or none are
+    outstanding).
+  */
+  pub void waitForCompletion ();
+  /**
+    Gets the number of writes whose buffers have yet to be reported by
+    collect().
+  */
+  pub size_t getPendingCount () const noexcept;
+  /**
+    Gets the number of zero-copy sends for which the system ended up copying
+    the data anyway (e.g. because the route is over loopback), which suggests
+    that the threshold should be raised.
+  */
+  pub iu64 getCopiedCount () const noexcept;
+  /**
+    Waits for every write's buffer to be released by the system and then
+    closes the stream (as for TcpSocketStream::close()).
+  */
+  pub void close ();
+};
+
 /**
   Manages a passive TCP socket.
 */
@@ -138,12 +700,228 @@ class PassiveTcpSocket {
     outstanding connection backlog size) at the given address.
   */
   pub explicit PassiveTcpSocket (const TcpSocketAddress &listenAddr);
+  /**
+    Creates a socket and configures it for listening (with the given maximum
+    outstanding connection backlog size) at the given address, optionally
+    sharing the address with other sockets (see Socket::setReusePort()).
+  */
+  pub PassiveTcpSocket (const TcpSocketAddress &listenAddr, iu listenBacklog, bool reusePort);
 
   /**
     Waits for connections to the address associated with this socket and returns
     a TcpSocketStream for the first.
   */
   pub TcpSocketStream accept (bool keepalive);
+  /**
+    Returns a TcpSocketStream for the first pending connection to the address
+    associated with this socket or, if the socket is in non-blocking mode and
+    there are no pending connections, returns nothing.
+  */
+  pub std::optional<TcpSocketStream> tryAccept (bool keepalive);
+  /**
+    Sets the options (see Socket::setOptions()) on the passive socket itself;
+    accepted connections inherit them from it, so acceptBatch() needn't set
+    them on each connection.
+  */
+  pub void setInheritedOptions (bool keepalive);
+  /**
+    Accepts all pending connections (up to the given maximum number) without
+    waiting, appending to the given vector a TcpSocketStream (in non-blocking
+    mode, with close-on-exec set and with the options set by
+    setInheritedOptions()) and the peer address for each. The passive socket
+    must be in non-blocking mode.
+
+    @return the number of connections accepted.
+  */
+  pub size_t acceptBatch (std::vector<std::tuple<TcpSocketStream, TcpSocketAddress>> &r_accepted, size_t maxCount);
+};
+
+/**
+  Manages a passive Unix-domain socket.
+*/
+class PassiveUnixSocket {
+  pub Socket socket;
+
+  /**
+    Creates a socket and configures it for listening (with the given maximum
+    outstanding connection backlog size) at the given address (which, if it's
+    a filesystem path, must not already exist).
+  */
+  pub PassiveUnixSocket (const UnixSocketAddress &listenAddr, iu listenBacklog);
+
+  /**
+    Waits for connections to the address associated with this socket and returns
+    a SocketStream for the first.
+  */
+  pub SocketStream accept ();
+  /**
+    Returns a SocketStream for the first pending connection to the address
+    associated with this socket or, if the socket is in non-blocking mode and
+    there are no pending connections, returns nothing.
+  */
+  pub std::optional<SocketStream> tryAccept ();
+};
+
+/**
+  A UDP socket that sends and receives datagrams in batches, with a single
+  system call per batch ({@c sendmmsg} and {@c recvmmsg}). Datagrams are
+  received into a fixed set of buffers that is allocated up front and reused
+  by every receive(). Segmentation offload is supported in both directions:
+  a send can hand the system one large buffer to be cut into equal-sized
+  datagrams (GSO), and, with setGro(), the system can deliver a run of
+  datagrams from the same source as one large buffer (GRO).
+*/
+class UdpSocket {
+  /**
+    Describes a datagram to send.
+  */
+  pub struct Datagram {
+    /**
+      The data (of which only the first {@c IOV_MAX} elements are sent, as
+      for Socket's methods).
+    */
+    const iovec *v;
+    size_t vSize;
+    /**
+      The destination, or nullptr to use the socket's connected address.
+    */
+    const TcpSocketAddress *destination;
+    /**
+      If non-zero, the size of the datagrams into which the data is to be cut
+      (via {@c UDP_SEGMENT}), all but the last of which are of exactly this
+      size.
+    */
+    iu16f segmentSize;
+  };
+  /**
+    Describes a received datagram (or, with GRO, run of datagrams).
+  */
+  pub struct ReceivedDatagram {
+    /**
+      The data, which remains valid until the next receive().
+    */
+    std::span<const iu8f> data;
+    /**
+      The sender's address (if it's an IP address).
+    */
+    std::optional<TcpSocketAddress> source;
+    /**
+      The size of each of the datagrams that the data is made of (all but the
+      last of which are of exactly this size); without GRO, the size of the
+      data.
+    */
+    size_t segmentSize;
+    /**
+      Whether the datagram was larger than a buffer (and so is cut short).
+    */
+    bool truncated;
+  };
+
+  prv Socket socket;
+  prv size_t bufferSize;
+  prv size_t bufferCount;
+  prv std::unique_ptr<iu8f[]> buffers;
+  prv std::unique_ptr<iovec[]> receiveV;
+  prv std::unique_ptr<sockaddr_storage[]> sourceAddrs;
+  prv std::unique_ptr<char[]> receiveControls;
+  prv std::unique_ptr<mmsghdr[]> receiveHeaders;
+  prv std::vector<ReceivedDatagram> received;
+  prv std::vector<mmsghdr> sendHeaders;
+  prv std::vector<char> sendControls;
+
+  /**
+    Creates a socket bound to the given address, with the given number of
+    receive buffers of the given size (which, with GRO, should be 64KiB).
+  */
+  pub UdpSocket (const TcpSocketAddress &bindAddr, size_t bufferCount, size_t bufferSize);
+
+  pub Socket &getSocket () noexcept;
+  /**
+    Gets the address that the socket is bound to (e.g. to find out which port
+    was picked, if it was bound to port zero).
+  */
+  pub TcpSocketAddress getLocalAddress () const;
+  /**
+    Sets the default destination of sent datagrams, and discards received
+    datagrams from any other address.
+  */
+  pub void connect (const TcpSocketAddress &addr);
+  /**
+    Lets the system coalesce runs of received datagrams (via {@c UDP_GRO}).
+  */
+  pub void setGro (bool gro);
+  /**
+    Receives as many datagrams as are available (up to one per buffer),
+    waiting for the first if the socket is in blocking mode.
+
+    @return the datagrams received (none if the socket is in non-blocking
+    mode and none were available), which remain valid until the next call.
+  */
+  pub std::span<const ReceivedDatagram> receive ();
+  /**
+    Sends as many of the given datagrams as the system will accept without
+    waiting (or, in blocking mode, at least one), with a single system call.
+
+    @return the number of datagrams sent (where a datagram that was cut
+    into segments counts as one).
+  */
+  pub size_t send (const Datagram *d, size_t dSize);
+};
+
+/**
+  Listens at an address with a number of shards, each of which has its own
+  passive socket (all sharing the address with {@c SO_REUSEPORT}, so that the
+  system spreads incoming connections across them) and its own thread running
+  an io::event::Reactor, on which it accepts connections and (via the given
+  handler) serves them. Shards can optionally be pinned to CPUs, in which case
+  the system is also asked to direct connections to the shard running on the
+  CPU that handled their arrival. A shard that fails to accept a connection
+  (e.g. because the process has run out of file descriptors) stops accepting
+  for a moment rather than retrying straight away.
+*/
+class ShardedTcpListener {
+  /**
+    A function to take on a newly-accepted connection, which is in
+    non-blocking mode (e.g. by registering it with the shard's reactor).
+  */
+  pub typedef std::function<void (io::event::Reactor &reactor, TcpSocketStream &&stream)> Handler;
+
+  prv struct Shard {
+    PassiveTcpSocket socket;
+    io::event::Reactor reactor;
+    int cpu;
+    /**
+      A {@c timerfd} for resuming accepting connections after a failure.
+    */
+    int retryTimerFd;
+    std::thread thread;
+
+    Shard (const TcpSocketAddress &listenAddr, iu listenBacklog, int cpu);
+    Shard (const Shard &) = delete;
+    Shard &operator= (const Shard &) = delete;
+    ~Shard () noexcept;
+  };
+
+  prv Handler handler;
+  prv std::vector<std::unique_ptr<Shard>> shards;
+
+  /**
+    Creates the given number of shards (or, if zero, one for each CPU
+    available to the process) and starts them.
+  */
+  pub ShardedTcpListener (const TcpSocketAddress &listenAddr, iu listenBacklog, size_t shardCount, bool pinToCpus, bool keepalive, Handler handler);
+  ShardedTcpListener (const ShardedTcpListener &) = delete;
+  ShardedTcpListener &operator= (const ShardedTcpListener &) = delete;
+  pub ~ShardedTcpListener () noexcept;
+
+  prv void run (Shard &shard);
+  prv static void pauseAccepting (Shard &shard);
+  pub size_t getShardCount () const noexcept;
+  /**
+    Stops all of the shards (after their current rounds of callbacks) and
+    waits for their threads to finish.
+  */
+  pub void stop () noexcept;
 };
 
 /* -----------------------------------------------------------------------------
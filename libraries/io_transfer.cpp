@@ -0,0 +1,203 @@
+#include "io_transfer.hpp"
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+namespace io::file { core::u8string createStrerror (int errnum, const char8_t *prefix = u8" (", const char8_t *suffix = u8")"); }
+
+namespace io::transfer {
+
+using core::u8string;
+using core::PlainException;
+using std::unique_ptr;
+using core::unsign;
+using core::numeric_limits;
+using io::file::RandomAccessFile;
+using io::socket::TcpSocketStream;
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+DC();
+
+using io::file::createStrerror;
+
+constexpr size_t BUFFER_SIZE = 65536;
+// The most that Linux will transfer in a single call.
+constexpr Offset MAX_CHUNK_SIZE = 0x7FFFF000;
+
+bool isUnsupported (int errnum) noexcept {
+  return errnum == EINVAL || errnum == ENOSYS || errnum == EOPNOTSUPP || errnum == EXDEV;
+}
+
+off_t toOff (Offset offset) {
+  if (offset > unsign(numeric_limits<off_t>::max())) {
+    throw PlainException(u8string(u8"failed to access file (requested position was too big)"));
+  }
+  return static_cast<off_t>(offset);
+}
+
+size_t getChunkSize (Offset remaining, Offset max) noexcept {
+  return static_cast<size_t>(remaining < max ? remaining : max);
+}
+
+Offset copyThroughBuffer (const RandomAccessFile &src, Offset srcOffset, TcpSocketStream &dst, Offset size) {
+  DW(, "sending file through a buffer");
+  unique_ptr<iu8f[]> b(new iu8f[BUFFER_SIZE]);
+  Offset done = 0;
+  while (done != size) {
+    size_t s = src.readAt(srcOffset + done, b.get(), getChunkSize(size - done, BUFFER_SIZE));
+    if (s == numeric_limits<size_t>::max()) {
+      break;
+    }
+    dst.write(b.get(), s);
+    done += s;
+  }
+  return done;
+}
+
+Offset transfer (const RandomAccessFile &src, Offset srcOffset, TcpSocketStream &dst, Offset size) {
+  int in = src.getDescriptor();
+  int out = dst.getSocket().getDescriptor();
+  Offset done = 0;
+  while (done != size) {
+    off_t o = toOff(srcOffset + done);
+    ssize_t r = sendfile(out, in, &o, getChunkSize(size - done, MAX_CHUNK_SIZE));
+    if (r == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        dst.getSocket().wait(POLLOUT);
+        continue;
+      }
+      if (isUnsupported(errno)) {
+        return done + copyThroughBuffer(src, srcOffset + done, dst, size - done);
+      }
+      throw PlainException(u8string(u8"failed to send file to a network socket") + createStrerror(errno));
+    }
+    if (r == 0) {
+      break;
+    }
+    done += unsign(r);
+  }
+  return done;
+}
+
+Offset copyThroughBuffer (const RandomAccessFile &src, Offset srcOffset, RandomAccessFile &dst, Offset dstOffset, Offset size) {
+  DW(, "copying file through a buffer");
+  unique_ptr<iu8f[]> b(new iu8f[BUFFER_SIZE]);
+  Offset done = 0;
+  while (done != size) {
+    size_t s = src.readAt(srcOffset + done, b.get(), getChunkSize(size - done, BUFFER_SIZE));
+    if (s == numeric_limits<size_t>::max()) {
+      break;
+    }
+    dst.writeAt(dstOffset + done, b.get(), s);
+    done += s;
+  }
+  return done;
+}
+
+Offset transfer (const RandomAccessFile &src, Offset srcOffset, RandomAccessFile &dst, Offset dstOffset, Offset size) {
+  int in = src.getDescriptor();
+  int out = dst.getDescriptor();
+  Offset done = 0;
+  while (done != size) {
+    off_t inO = toOff(srcOffset + done);
+    off_t outO = toOff(dstOffset + done);
+    ssize_t r = copy_file_range(in, &inO, out, &outO, getChunkSize(size - done, MAX_CHUNK_SIZE), 0);
+    if (r == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // (EBADF covers a destination opened for appending.)
+      if (isUnsupported(errno) || errno == EBADF) {
+        return done + copyThroughBuffer(src, srcOffset + done, dst, dstOffset + done, size - done);
+      }
+      throw PlainException(u8string(u8"failed to copy between files") + createStrerror(errno));
+    }
+    if (r == 0) {
+      break;
+    }
+    done += unsign(r);
+  }
+  return done;
+}
+
+Offset copyThroughBuffer (TcpSocketStream &src, TcpSocketStream &dst, Offset size) {
+  DW(, "forwarding stream through a buffer");
+  unique_ptr<iu8f[]> b(new iu8f[BUFFER_SIZE]);
+  Offset done = 0;
+  while (done != size) {
+    size_t s = src.read(b.get(), getChunkSize(size - done, BUFFER_SIZE));
+    if (s == numeric_limits<size_t>::max()) {
+      break;
+    }
+    if (s == TcpSocketStream::wouldBlock) {
+      src.getSocket().wait(POLLIN);
+      continue;
+    }
+    dst.write(b.get(), s);
+    done += s;
+  }
+  return done;
+}
+
+Offset transfer (TcpSocketStream &src, TcpSocketStream &dst, Offset size) {
+  int p[2];
+  if (pipe2(p, O_CLOEXEC) != 0) {
+    return copyThroughBuffer(src, dst, size);
+  }
+  finally([&] () {
+    ::close(p[0]);
+    ::close(p[1]);
+  });
+
+  int in = src.getSocket().getDescriptor();
+  int out = dst.getSocket().getDescriptor();
+  Offset done = 0;
+  while (done != size) {
+    ssize_t r = splice(in, nullptr, p[1], nullptr, getChunkSize(size - done, BUFFER_SIZE), SPLICE_F_MOVE);
+    if (r == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // (Sockets in non-blocking mode make splice() non-blocking too.)
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        src.getSocket().wait(POLLIN);
+        continue;
+      }
+      if (isUnsupported(errno)) {
+        // The pipe is empty, so nothing can be lost by switching.
+        return done + copyThroughBuffer(src, dst, size - done);
+      }
+      throw PlainException(u8string(u8"failed to read from a network socket") + createStrerror(errno));
+    }
+    if (r == 0) {
+      break;
+    }
+
+    // Drain the pipe into the destination.
+    for (auto inPipe = unsign(r); inPipe != 0;) {
+      ssize_t w = splice(p[0], nullptr, out, nullptr, inPipe, SPLICE_F_MOVE);
+      if (w == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          dst.getSocket().wait(POLLOUT);
+          continue;
+        }
+        throw PlainException(u8string(u8"failed to write to a network socket") + createStrerror(errno));
+      }
+      inPipe -= unsign(w);
+    }
+    done += unsign(r);
+  }
+  return done;
+}
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
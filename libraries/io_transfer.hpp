@@ -0,0 +1,59 @@
+/** @file */
+/* -----------------------------------------------------------------------------
+   Transfer I/O Library
+   © Geoff Crossland 2017-2022
+----------------------------------------------------------------------------- */
+#ifndef IO_TRANSFER_ALREADYINCLUDED
+#define IO_TRANSFER_ALREADYINCLUDED
+
+#include "io_file.hpp"
+#include "io_socket.hpp"
+#include <core.hpp>
+
+namespace io::transfer {
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+extern DC();
+
+typedef io::file::RandomAccessFile::Offset Offset;
+
+/**
+  Sends up to the given number of bytes, from the given position in the given
+  file, to the given socket, within the kernel (via {@c sendfile}) or, if the
+  kernel doesn't support that for these descriptors, through a user-space
+  buffer.
+
+  @return the number of bytes sent (which is less than requested only if the
+  end of the file was reached).
+*/
+Offset transfer (const io::file::RandomAccessFile &src, Offset srcOffset, io::socket::TcpSocketStream &dst, Offset size);
+/**
+  Copies up to the given number of bytes, from the given position in the
+  given file, to the given position in the other given file, within the
+  kernel (via {@c copy_file_range}, which can share extents on filesystems
+  that support it) or, if the kernel doesn't support that for these files,
+  through a user-space buffer.
+
+  @return the number of bytes copied (which is less than requested only if
+  the end of the source file was reached).
+*/
+Offset transfer (const io::file::RandomAccessFile &src, Offset srcOffset, io::file::RandomAccessFile &dst, Offset dstOffset, Offset size);
+/**
+  Forwards up to the given number of bytes from the given socket to the other
+  given socket, within the kernel (via {@c splice} through a pipe) or, if the
+  kernel doesn't support that for these sockets, through a user-space buffer.
+
+  Either socket may be in non-blocking mode, in which case this waits for it
+  as necessary.
+
+  @return the number of bytes forwarded (which is less than requested only if
+  the end of the source stream was reached).
+*/
+Offset transfer (io::socket::TcpSocketStream &src, io::socket::TcpSocketStream &dst, Offset size);
+
+/* -----------------------------------------------------------------------------
+----------------------------------------------------------------------------- */
+}
+
+#endif
@@ -1,16 +1,126 @@
 #include "header.hpp"
+#include <cerrno>
+#include <chrono>
+#include <vector>
 
 using core::check;
+using core::u8string;
+using core::PlainException;
+using std::vector;
 
 /* -----------------------------------------------------------------------------
 ----------------------------------------------------------------------------- */
 DC();
 
+void testResolver () {
+  using io::socket::TcpSocketAddress;
+
+  io::resolve::Resolver resolver(io::resolve::Resolver::Policy{std::chrono::minutes(1), std::chrono::minutes(1), 16}, 1);
+
+  vector<TcpSocketAddress> addrs;
+  resolver.get(addrs, u8string(u8"127.0.0.1"), 80);
+  check(addrs.size() == 1);
+  check(addrs[0].getPort() == 80);
+  check(resolver.getEntryCount() == 1);
+
+  addrs.clear();
+  resolver.get(addrs, u8string(u8"localhost"), 443);
+  check(!addrs.empty());
+  check(addrs[0].getPort() == 443);
+  check(resolver.getEntryCount() == 2);
+
+  // A cached name isn't resolved again, but still gets the requested port.
+  vector<TcpSocketAddress> cachedAddrs = resolver.resolve(u8string(u8"localhost"), 8080).get();
+  check(cachedAddrs.size() == addrs.size());
+  check(cachedAddrs[0].getPort() == 8080);
+  check(resolver.getEntryCount() == 2);
+
+  // An empty name fails without any network, and the failure is cached.
+  for (int i = 0; i != 2; ++i) {
+    bool failed = false;
+    try {
+      vector<TcpSocketAddress> badAddrs;
+      resolver.get(badAddrs, u8string(), 80);
+    } catch (PlainException &) {
+      failed = true;
+    }
+    check(failed);
+    check(resolver.getEntryCount() == 3);
+  }
+  resolver.forget(u8string());
+  check(resolver.getEntryCount() == 2);
+}
+
+void testWriteAll () {
+  char b0[] = "hello", b1[] = "", b2[] = "world";
+  iovec v[] = {{b0, 5}, {b1, 0}, {b2, 5}};
+
+  // Each call writes at most three bytes, so writing resumes mid-element.
+  u8string written;
+  io::writeAll(v, 3, [&] (const iovec *w, size_t) -> size_t {
+    size_t s = w->iov_len < 3 ? w->iov_len : 3;
+    written.append(static_cast<const char8_t *>(w->iov_base), s);
+    return s;
+  });
+  check(written == u8string(u8"helloworld"));
+
+  bool failed = false;
+  try {
+    io::writeAll(v, 3, [] (const iovec *, size_t) -> size_t {
+      return 0;
+    });
+  } catch (PlainException &) {
+    failed = true;
+  }
+  check(failed);
+}
+
+void testTryApis () {
+  using io::socket::SocketStream;
+
+  auto [s0, s1] = SocketStream::createPair();
+  iu8f b[4] = {1, 2, 3, 4};
+  check(s0.tryWrite(b, 4).getSize() == 4);
+
+  // A request for nothing can't be mistaken for the end of the stream...
+  io::Result r = s1.tryRead(b, 0);
+  check(!r.succeeded());
+  check(r.getError() == EINVAL);
+  check(s1.tryRead(b, 4).getSize() == 4);
+
+  // ... which is a size of zero.
+  s0.getSocket().shutdown(SHUT_WR);
+  r = s1.tryRead(b, 4);
+  check(r.succeeded());
+  check(r.getSize() == 0);
+
+  // Writing to a peer that has gone away fails with EPIPE (rather than
+  // raising SIGPIPE).
+  s1.getSocket().close();
+  r = s0.tryWrite(b, 4);
+  check(!r.succeeded());
+  check(r.getError() == EPIPE);
+  r = s0.getSocket().trySend(b, 4);
+  check(r.getError() == EPIPE);
+}
+
 int main (int argc, char *argv[]) {
   DI(std::shared_ptr<core::debug::Stream> errs(new core::debug::Stream());)
   DOPEN(, errs);
   io::file::DOPEN(, errs);
   io::socket::DOPEN(, errs);
+  io::async::DOPEN(, errs);
+  io::log::DOPEN(, errs);
+  io::transfer::DOPEN(, errs);
+  io::event::DOPEN(, errs);
+  io::coroutine::DOPEN(, errs);
+  io::connect::DOPEN(, errs);
+  io::resolve::DOPEN(, errs);
+  io::linger::DOPEN(, errs);
+
+  testResolver();
+  testWriteAll();
+  testTryApis();
 
   return 0;
 }